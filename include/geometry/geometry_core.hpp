@@ -0,0 +1,260 @@
+#ifndef GEOMETRY_CORE_HPP
+#define GEOMETRY_CORE_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <opencv2/core/core.hpp>
+
+#include "sophus/se3.hpp"
+#include "../utils/poses.hpp"
+#include "../utils/pprint_utils.hpp"
+
+namespace motion::geometry {
+
+    /**
+     * Pinhole camera without distortion. A literal type, so camera constants live in read only memory and the
+     * matrices below are built on the stack.
+     */
+    struct PinholeCamera {
+        double fx;
+        double fy;
+        double cx;
+        double cy;
+
+        [[nodiscard]]
+        auto matrix() const -> Eigen::Matrix3d {
+            return (Eigen::Matrix3d() << fx, 0, cx, 0, fy, cy, 0, 0, 1).finished();
+        }
+
+        [[nodiscard]]
+        auto to_cv() const -> cv::Matx33d {
+            return cv::Matx33d(fx, 0, cx, 0, fy, cy, 0, 0, 1);
+        }
+
+        [[nodiscard]]
+        auto principal_point() const -> cv::Point2d {
+            return {cx, cy};
+        }
+
+        [[nodiscard]]
+        auto project(const Eigen::Vector3d& point_camera) const -> Eigen::Vector2d {
+            return {fx * point_camera.x() / point_camera.z() + cx, fy * point_camera.y() / point_camera.z() + cy};
+        }
+
+        /**
+         * Normalised image ray (z = 1) through a pixel
+         */
+        [[nodiscard]]
+        auto unproject(const Eigen::Vector2d& pixel) const -> Eigen::Vector3d {
+            return {(pixel.x() - cx) / fx, (pixel.y() - cy) / fy, 1.0};
+        }
+
+        [[nodiscard]]
+        auto unproject(const cv::Point2f& pixel) const -> Eigen::Vector3d {
+            return unproject(Eigen::Vector2d{pixel.x, pixel.y});
+        }
+    };
+
+    namespace cameras {
+        constexpr PinholeCamera TUM_FREIBURG_1 {520.9, 521.0, 325.1, 249.7};
+        // resources/image_data/einstein_1_stereo_dataset/calibration2.txt
+        constexpr PinholeCamera EINSTEIN_CALIBRATION_2 {726.04388427734, 726.04388427734, 385.73248291016, 262.19641113281};
+    }
+
+    /**
+     * Reads "fx fy cx cy" from the first line of a calibration file such as the einstein calibration2.txt
+     */
+    inline auto read_pinhole_camera(const std::filesystem::path& path) -> std::optional<PinholeCamera> {
+        std::ifstream input_file_stream(path);
+        if (!input_file_stream.is_open()) {
+            return std::nullopt;
+        }
+        PinholeCamera camera{};
+        if (!(input_file_stream >> camera.fx >> camera.fy >> camera.cx >> camera.cy)) {
+            return std::nullopt;
+        }
+        return camera;
+    }
+
+    /**
+     * Adapters at the OpenCV boundary. The Eigen maps alias the OpenCV buffer, nothing is copied or allocated.
+     */
+    namespace cv_adapters {
+        using RowMajorMatrix3d = Eigen::Matrix<double, 3, 3, Eigen::RowMajor>;
+
+        inline auto as_eigen(const cv::Matx33d& matrix) -> Eigen::Map<const RowMajorMatrix3d> {
+            return Eigen::Map<const RowMajorMatrix3d>(matrix.val);
+        }
+
+        inline auto as_eigen(const cv::Vec3d& vector) -> Eigen::Map<const Eigen::Vector3d> {
+            return Eigen::Map<const Eigen::Vector3d>(vector.val);
+        }
+
+        /**
+         * Views a continuous CV_64F 3x3 cv::Mat, e.g. the output of cv::recoverPose
+         */
+        inline auto as_eigen_3x3(const cv::Mat& matrix) -> Eigen::Map<const RowMajorMatrix3d> {
+            assert(matrix.type() == CV_64FC1 and matrix.rows == 3 and matrix.cols == 3 and matrix.isContinuous());
+            return Eigen::Map<const RowMajorMatrix3d>(matrix.ptr<double>());
+        }
+
+        /**
+         * Views a continuous CV_64F 3x1 / 1x3 cv::Mat
+         */
+        inline auto as_eigen_3x1(const cv::Mat& vector) -> Eigen::Map<const Eigen::Vector3d> {
+            assert(vector.type() == CV_64FC1 and vector.total() == 3 and vector.isContinuous());
+            return Eigen::Map<const Eigen::Vector3d>(vector.ptr<double>());
+        }
+
+        /**
+         * Rotation is re-orthogonalised, OpenCV estimates are only orthonormal up to numerical noise
+         */
+        inline auto to_sophus(const cv::Matx33d& rotation, const cv::Vec3d& translation) -> Sophus::SE3d {
+            return {Sophus::SO3d::fitToSO3(as_eigen(rotation)), as_eigen(translation)};
+        }
+
+        inline auto to_sophus(const cv::Mat& rotation, const cv::Mat& translation) -> Sophus::SE3d {
+            return {Sophus::SO3d::fitToSO3(as_eigen_3x3(rotation)), as_eigen_3x1(translation)};
+        }
+
+        /**
+         * Rodrigues rotation vector and translation, as returned by cv::solvePnP / cv::solvePnPRansac
+         */
+        inline auto from_rodrigues(const cv::Mat& rotation_vector, const cv::Mat& translation) -> Sophus::SE3d {
+            return {Sophus::SO3d::exp(as_eigen_3x1(rotation_vector)), as_eigen_3x1(translation)};
+        }
+
+        inline auto to_cv(const Sophus::SE3d& pose) -> std::pair<cv::Matx33d, cv::Vec3d> {
+            std::pair<cv::Matx33d, cv::Vec3d> rotation_translation;
+            Eigen::Map<RowMajorMatrix3d>(rotation_translation.first.val) = pose.rotationMatrix();
+            Eigen::Map<Eigen::Vector3d>(rotation_translation.second.val) = pose.translation();
+            return rotation_translation;
+        }
+    }
+
+    /**
+     * A pose as [angle axis rotation, translation], the parameter block layout of ceres::AngleAxisRotatePoint costs
+     */
+    using AngleAxisPose = std::array<double, 6>;
+
+    inline auto to_angle_axis(const Sophus::SE3d& pose) -> AngleAxisPose {
+        AngleAxisPose parameters;
+        Eigen::Map<Eigen::Vector3d>(parameters.data()) = pose.so3().log();
+        Eigen::Map<Eigen::Vector3d>(parameters.data() + 3) = pose.translation();
+        return parameters;
+    }
+
+    inline auto from_angle_axis(const AngleAxisPose& parameters) -> Sophus::SE3d {
+        return {Sophus::SO3d::exp(Eigen::Map<const Eigen::Vector3d>(parameters.data())), Eigen::Map<const Eigen::Vector3d>(parameters.data() + 3)};
+    }
+
+    /**
+     * Chains relative poses into a trajectory without per step allocations once reserved.
+     * Each relative pose maps frame k into frame k + 1 (the recoverPose convention), the trajectory stores the
+     * camera to world pose of every frame.
+     */
+    class TrajectoryAccumulator {
+        Sophus::SE3d world_from_current_;
+        utils::PosesVector poses_;
+
+    public:
+        explicit TrajectoryAccumulator(const std::size_t expected_frames = 0, const Sophus::SE3d& world_from_first = {})
+        : world_from_current_(world_from_first) {
+            poses_.reserve(expected_frames + 1);
+            poses_.emplace_back(world_from_current_.matrix());
+        }
+
+        auto append(const Sophus::SE3d& next_from_current) -> const Sophus::SE3d& {
+            world_from_current_ = world_from_current_ * next_from_current.inverse();
+            poses_.emplace_back(world_from_current_.matrix());
+            return world_from_current_;
+        }
+
+        [[nodiscard]]
+        auto current() const -> const Sophus::SE3d& {
+            return world_from_current_;
+        }
+
+        [[nodiscard]]
+        auto poses() const -> const utils::PosesVector& {
+            return poses_;
+        }
+
+        /**
+         * Hands the trajectory over once accumulation is done, std::move(accumulator).take_poses()
+         */
+        [[nodiscard]]
+        auto take_poses() && -> utils::PosesVector {
+            return std::move(poses_);
+        }
+    };
+
+    inline auto compose_trajectory(const std::span<const Sophus::SE3d> relative_poses, const Sophus::SE3d& world_from_first = {}) -> utils::PosesVector {
+        TrajectoryAccumulator accumulator(relative_poses.size(), world_from_first);
+        for (const Sophus::SE3d& relative_pose : relative_poses) {
+            accumulator.append(relative_pose);
+        }
+        return std::move(accumulator).take_poses();
+    }
+
+    /**
+     * Chains known camera to world poses through their relative poses and round trips the OpenCV / ceres adapters
+     */
+    inline auto test_geometry_core() -> void {
+        constexpr double TOLERANCE {1e-9};
+        const std::array<Sophus::SE3d, 4> world_from_camera {
+            Sophus::SE3d{},
+            Sophus::SE3d::exp((Sophus::SE3d::Tangent() << 0.5, -0.2, 1.0, 0.05, 0.1, -0.02).finished()),
+            Sophus::SE3d::exp((Sophus::SE3d::Tangent() << 1.1, -0.1, 1.9, 0.12, 0.3, 0.01).finished()),
+            Sophus::SE3d::exp((Sophus::SE3d::Tangent() << 1.4, 0.3, 2.5, -0.2, 0.45, 0.1).finished())
+        };
+        const Eigen::Vector3d point_world {0.3, -1.2, 4.0};
+        bool passed {true};
+        auto check = [&](const bool condition, const std::string& what) {
+            if (not condition) {
+                std::cout << motion::utils::RED << what << " failed" << motion::utils::RESET << std::endl;
+                passed = false;
+            }
+        };
+
+        std::vector<Sophus::SE3d> relative_poses;
+        for (std::size_t k = 0; k + 1 < world_from_camera.size(); ++k) {
+            const Sophus::SE3d next_from_current = world_from_camera[k + 1].inverse() * world_from_camera[k];
+            // The relative pose takes a point from camera k into camera k + 1, as cv::recoverPose does
+            const Eigen::Vector3d point_current = world_from_camera[k].inverse() * point_world;
+            const Eigen::Vector3d point_next = world_from_camera[k + 1].inverse() * point_world;
+            check((next_from_current * point_current - point_next).norm() < TOLERANCE, "relative pose convention " + std::to_string(k));
+            relative_poses.push_back(next_from_current);
+        }
+
+        const Sophus::SE3d& world_from_first = world_from_camera.front();
+        const utils::PosesVector trajectory = compose_trajectory(relative_poses, world_from_first);
+        check(trajectory.size() == world_from_camera.size(), "trajectory size");
+        for (std::size_t k = 0; k < std::min(trajectory.size(), world_from_camera.size()); ++k) {
+            check((trajectory[k].matrix() - world_from_camera[k].matrix()).norm() < TOLERANCE, "composed pose " + std::to_string(k));
+        }
+
+        TrajectoryAccumulator accumulator(relative_poses.size(), world_from_first);
+        for (const Sophus::SE3d& relative_pose : relative_poses) {
+            accumulator.append(relative_pose);
+        }
+        check((accumulator.current().matrix() - world_from_camera.back().matrix()).norm() < TOLERANCE, "accumulator current pose");
+        const utils::PosesVector taken = std::move(accumulator).take_poses();
+        check(taken.size() == world_from_camera.size(), "taken trajectory size");
+
+        const Sophus::SE3d& pose = world_from_camera[2];
+        const auto [rotation, translation] = cv_adapters::to_cv(pose);
+        check(cv_adapters::as_eigen(rotation).data() == rotation.val, "as_eigen aliases the cv::Matx");
+        check((cv_adapters::to_sophus(rotation, translation).matrix() - pose.matrix()).norm() < TOLERANCE, "cv::Matx round trip");
+        check((cv_adapters::to_sophus(cv::Mat(rotation), cv::Mat(translation)).matrix() - pose.matrix()).norm() < TOLERANCE, "cv::Mat round trip");
+        const Eigen::Vector3d rotation_vector = pose.so3().log();
+        const cv::Vec3d rodrigues {rotation_vector.x(), rotation_vector.y(), rotation_vector.z()};
+        check((cv_adapters::from_rodrigues(cv::Mat(rodrigues), cv::Mat(translation)).matrix() - pose.matrix()).norm() < TOLERANCE, "rodrigues round trip");
+        check((from_angle_axis(to_angle_axis(pose)).matrix() - pose.matrix()).norm() < TOLERANCE, "angle axis round trip");
+
+        std::cout << (passed ? motion::utils::GREEN + "geometry core ok" : motion::utils::RED + "geometry core FAILED")
+                  << motion::utils::RESET << std::endl;
+    }
+}
+
+#endif //GEOMETRY_CORE_HPP
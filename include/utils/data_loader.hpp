@@ -9,12 +9,23 @@
 #include <utility>
 #include <opencv2/imgcodecs.hpp>
 #include "pprint_utils.hpp"
+#include "feature_store.hpp"
+#include "decode_policy.hpp"
 
 namespace motion::utils {
     namespace dataloader {
+        /**
+         * A dataset item. When the dataset has a feature store attached, `feature_key` identifies the sample and
+         * `features` is filled on a cache hit, in which case `image` is left empty (nothing was decoded).
+         * Keypoints of `image` / `features` live in the decoded frame, `pixel_transform` maps them (and the camera
+         * intrinsics) back to full resolution.
+         */
         struct ImageSample {
             std::string path;
-            cv::Mat image;
+            cv::Mat image {};
+            decoding::PixelTransform pixel_transform {};
+            std::optional<feature_store::FeatureKey> feature_key {std::nullopt};
+            std::optional<feature_store::ImageFeatures> features {std::nullopt};
         };
 
         using ImageBatch = std::vector<ImageSample>;
@@ -24,8 +35,98 @@ namespace motion::utils {
             virtual ~Dataset() = default;
             virtual auto size() -> std::size_t = 0;
             virtual auto get_item(const std::size_t idx) -> ImageSample = 0;
+            virtual auto decode_policy() const -> const decoding::DecodePolicy& = 0;
+            virtual auto set_decode_policy(decoding::DecodePolicy decode_policy) -> void = 0;
+            /**
+             * Keys every sample for `store` and serves cached features on a hit
+             * @param extractor_fingerprint fingerprint of the extractor that will consume the samples
+             */
+            virtual auto attach_feature_store(std::shared_ptr<feature_store::FeatureStore> store, std::uint64_t extractor_fingerprint) -> Dataset& = 0;
+        };
+
+
+        enum class ShardMode {
+            Contiguous,     // rank r takes one consecutive block of the epoch order
+            Strided         // rank r takes positions r, r + world_size, r + 2 * world_size ...
         };
 
+        /**
+         * Which slice of every epoch this process iterates. With neither drop_last nor pad the first
+         * (size % world_size) ranks get one extra sample.
+         */
+        struct ShardOptions {
+            std::size_t rank {0};
+            std::size_t world_size {1};
+            ShardMode mode {ShardMode::Strided};
+            bool drop_last {false};     // Drop the tail of the epoch so every rank gets size / world_size samples
+            bool pad {false};           // Repeat the head of the epoch so every rank gets ceil(size / world_size) samples
+        };
+
+        constexpr std::uint64_t DEFAULT_SEED {0x5eed5eed5eedULL};
+
+        /**
+         * Epoch orderings only depend on (seed, epoch, dataset size). The shuffle is a Fisher-Yates driven by
+         * std::mt19937_64 with rejection sampling, both fully specified by the standard, so every process on
+         * every machine / standard library computes the same permutation.
+         */
+        inline auto epoch_permutation(const std::size_t size, const std::uint64_t seed, const std::size_t epoch, const bool shuffle) -> std::vector<std::size_t> {
+            std::vector<std::size_t> order(size);
+            std::iota(order.begin(), order.end(), std::size_t{0});
+            if (not shuffle or size < 2) {
+                return order;
+            }
+            std::seed_seq seed_sequence{
+                static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                static_cast<std::uint32_t>(epoch), static_cast<std::uint32_t>(static_cast<std::uint64_t>(epoch) >> 32)
+            };
+            std::mt19937_64 rng(seed_sequence);
+            for (std::size_t i = size - 1; i > 0; --i) {
+                const std::uint64_t bound = static_cast<std::uint64_t>(i) + 1;
+                const std::uint64_t limit = std::numeric_limits<std::uint64_t>::max() - std::numeric_limits<std::uint64_t>::max() % bound;
+                std::uint64_t draw;
+                do {
+                    draw = rng();
+                } while (draw >= limit);
+                std::swap(order[i], order[static_cast<std::size_t>(draw % bound)]);
+            }
+            return order;
+        }
+
+        /**
+         * Dataset positions of one rank's slice of an epoch order
+         */
+        inline auto shard_indexes(std::vector<std::size_t> epoch_order, const ShardOptions& shard) -> std::vector<std::size_t> {
+            assert(shard.world_size > 0 and shard.rank < shard.world_size);
+            if (epoch_order.empty()) {
+                return epoch_order;
+            }
+            const std::size_t world_size = shard.world_size;
+            if (shard.drop_last) {
+                epoch_order.resize(epoch_order.size() / world_size * world_size);
+            } else if (shard.pad) {
+                const std::size_t padded_size = (epoch_order.size() + world_size - 1) / world_size * world_size;
+                for (std::size_t i = 0; epoch_order.size() < padded_size; ++i) {
+                    epoch_order.push_back(epoch_order[i]);
+                }
+            }
+
+            const std::size_t size = epoch_order.size();
+            std::vector<std::size_t> indexes;
+            indexes.reserve(size / world_size + 1);
+            if (shard.mode == ShardMode::Strided) {
+                for (std::size_t i = shard.rank; i < size; i += world_size) {
+                    indexes.push_back(epoch_order[i]);
+                }
+            } else {
+                const std::size_t base = size / world_size;
+                const std::size_t remainder = size % world_size;
+                const std::size_t first = shard.rank * base + std::min(shard.rank, remainder);
+                const std::size_t count = base + (shard.rank < remainder ? 1 : 0);
+                indexes.assign(epoch_order.begin() + static_cast<std::ptrdiff_t>(first),
+                               epoch_order.begin() + static_cast<std::ptrdiff_t>(first + count));
+            }
+            return indexes;
+        }
 
         template<typename SampleT, typename BatchT>
         class DataLoader;
@@ -34,9 +135,6 @@ namespace motion::utils {
         class DataLoaderIterator {
             DataLoader<SampleT, BatchT>* dataloader_;
             std::size_t current_sample_start_idx_;
-            std::size_t current_batch_index_;
-
-            bool is_begin_;
         public:
             using iterator_category = std::input_iterator_tag;
             using difference_type = std::ptrdiff_t;
@@ -56,7 +154,10 @@ namespace motion::utils {
         };
 
         /**
-         * The dataloder class provides an abstraction to iterate over batches of images
+         * The dataloder class provides an abstraction to iterate over batches of images.
+         * Iteration order is a pure function of (seed, epoch, dataset size, shard options): N processes constructed
+         * with the same seed and ranks 0..N-1 visit disjoint slices that together cover the epoch.
+         * Every call to begin() iterates the current epoch and advances to the next one, set_epoch() overrides it.
          * @tparam SampleT template for ample type
          * @tparam BatchT colletion template for batching type
          */
@@ -67,28 +168,57 @@ namespace motion::utils {
             std::shared_ptr<Dataset> dataset_;
             std::size_t batch_size_;
             bool shuffle_;
+            std::uint64_t seed_;
+            ShardOptions shard_;
+            std::size_t epoch_ {0};
             std::vector<std::size_t> curr_epoch_indexes_;
-            mutable std::mt19937 rng_;
 
         public:
-            explicit DataLoader(std::shared_ptr<Dataset> dataset, std::size_t batch_size, bool shuffle)
+            explicit DataLoader(std::shared_ptr<Dataset> dataset, std::size_t batch_size, bool shuffle,
+                                std::uint64_t seed = DEFAULT_SEED, ShardOptions shard = {})
             :   dataset_(std::move(dataset)),
-                batch_size_(batch_size),
+                batch_size_(std::max<std::size_t>(batch_size, 1)),
                 shuffle_(shuffle),
-                rng_(std::random_device{}()),
-                curr_epoch_indexes_(
-                    std::ranges::to<std::vector<std::size_t>>(
-                        std::views::iota(0)
-                        | std::views::take(dataset_->size())
-                    )
-                    ) {
-                std::ranges::shuffle(curr_epoch_indexes_, rng_);
+                seed_(seed),
+                shard_(shard) {
+                if (shard_.world_size == 0 or shard_.rank >= shard_.world_size) {
+                    throw std::invalid_argument("DataLoader shard rank must be smaller than the world size");
+                }
+                curr_epoch_indexes_ = indexes_for_epoch(epoch_);
+            }
+
+            auto set_epoch(const std::size_t epoch) -> void {
+                epoch_ = epoch;
+            }
+
+            [[nodiscard]]
+            auto epoch() const -> std::size_t {
+                return epoch_;
+            }
+
+            /**
+             * Dataset indexes this rank visits in `epoch`, in order
+             */
+            [[nodiscard]]
+            auto indexes_for_epoch(const std::size_t epoch) const -> std::vector<std::size_t> {
+                return shard_indexes(epoch_permutation(dataset_->size(), seed_, epoch, shuffle_), shard_);
+            }
+
+            /**
+             * Samples this rank sees per epoch
+             */
+            [[nodiscard]]
+            auto num_samples() const -> std::size_t {
+                return curr_epoch_indexes_.size();
+            }
+
+            [[nodiscard]]
+            auto num_batches() const -> std::size_t {
+                return (curr_epoch_indexes_.size() + batch_size_ - 1) / batch_size_;
             }
 
             auto begin() -> DataLoaderIterator<SampleT, BatchT> {
-                if (shuffle_) {
-                    std::ranges::shuffle(curr_epoch_indexes_, rng_);
-                }
+                curr_epoch_indexes_ = indexes_for_epoch(epoch_++);
                 return DataLoaderIterator<SampleT, BatchT>{this, true};
             };
 
@@ -99,26 +229,21 @@ namespace motion::utils {
 
         template<typename SampleT, typename BatchT>
         DataLoaderIterator<SampleT, BatchT>::DataLoaderIterator(DataLoader<SampleT, BatchT> *dataloader, bool is_begin): dataloader_(
-            dataloader), current_sample_start_idx_(0), is_begin_(is_begin) {
-            if (is_begin) {
-                current_batch_index_ = 0;
-            } else {
-                current_batch_index_ = dataloader->dataset_->size();
-            }
+            dataloader), current_sample_start_idx_(is_begin ? 0 : dataloader->num_batches() * dataloader->batch_size_) {
         }
 
         template<typename SampleT, typename BatchT>
         auto DataLoaderIterator<SampleT, BatchT>::operator*() const -> BatchT {
             BatchT batch;
             batch.reserve(dataloader_->batch_size_);
-            const std::size_t end_idx_in_dataset {
+            const std::size_t end_idx_in_epoch {
                 std::min(
                     current_sample_start_idx_ + dataloader_->batch_size_,
-                    dataloader_->dataset_->size()
+                    dataloader_->curr_epoch_indexes_.size()
                     )
             };
 
-            for (int i = current_sample_start_idx_; i < end_idx_in_dataset; ++i) {
+            for (std::size_t i = current_sample_start_idx_; i < end_idx_in_epoch; ++i) {
                 const std::size_t actual_dataset_idx = dataloader_->curr_epoch_indexes_[i];
                 batch.push_back(dataloader_->dataset_->get_item(actual_dataset_idx));
             }
@@ -133,21 +258,20 @@ namespace motion::utils {
 
         template<typename SampleT, typename BatchT>
         auto DataLoaderIterator<SampleT, BatchT>::operator++(int) -> DataLoaderIterator {
-            DataLoader<SampleT, BatchT> tmp = *this;
+            DataLoaderIterator tmp = *this;
             ++(*this);
             return tmp;
         }
 
         template<typename SampleT, typename BatchT>
         auto DataLoaderIterator<SampleT, BatchT>::operator!=(const DataLoaderIterator &other) const -> bool {
-            return current_sample_start_idx_ != other.current_sample_start_idx_
-                || dataloader_ != other.dataloader_;
+            return not (*this == other);
         }
 
         template<typename SampleT, typename BatchT>
         auto DataLoaderIterator<SampleT, BatchT>::operator==(const DataLoaderIterator &other) const -> bool {
             return current_sample_start_idx_ == other.current_sample_start_idx_
-                || dataloader_ == other.dataloader_;
+                && dataloader_ == other.dataloader_;
         }
 
     }
@@ -163,9 +287,12 @@ namespace motion::utils {
             std::string root_dir_;
             std::string sub_dir_;
             std::vector<std::string> image_paths_;
+            decoding::DecodePolicy decode_policy_;
+            std::shared_ptr<feature_store::FeatureStore> feature_store_;
+            std::uint64_t extractor_fingerprint_ {0};
         public:
-            ImagePathDataSet(std::string  root_dir, std::string  sub_dir)
-            : root_dir_(std::move(root_dir)), sub_dir_(std::move(sub_dir)) {
+            ImagePathDataSet(std::string  root_dir, std::string  sub_dir, decoding::DecodePolicy decode_policy = {})
+            : root_dir_(std::move(root_dir)), sub_dir_(std::move(sub_dir)), decode_policy_(std::move(decode_policy)) {
                 fs::path images_file_path = fs::path(root_dir_) / sub_dir_ ;
                 if (fs::exists(images_file_path) and fs::is_directory(images_file_path)) {
                     const auto filtered_view = std::ranges::to<std::vector>(
@@ -195,11 +322,55 @@ namespace motion::utils {
                 return image_paths_.size();
             }
 
+            /**
+             * Serve cached features from `store` for every image whose content and extractor fingerprint match
+             */
+            auto attach_feature_store(std::shared_ptr<feature_store::FeatureStore> store, const std::uint64_t extractor_fingerprint) -> ImagePathDataSet& override {
+                feature_store_ = std::move(store);
+                extractor_fingerprint_ = extractor_fingerprint;
+                return *this;
+            }
+
+            auto decode_policy() const -> const decoding::DecodePolicy& override {
+                return decode_policy_;
+            }
+
+            auto set_decode_policy(decoding::DecodePolicy decode_policy) -> void override {
+                decode_policy_ = std::move(decode_policy);
+            }
+
             auto get_item(const std::size_t idx) -> dataloader::ImageSample override {
                 const std::string image_path = image_paths_.at(idx);
+                const decoding::PixelTransform pixel_transform = decode_policy_.pixel_transform();
+                if (feature_store_ == nullptr) {
+                    return {
+                        .path = image_path,
+                        .image = decode_policy_.decode(image_path),
+                        .pixel_transform = pixel_transform
+                    };
+                }
+
+                auto encoded_bytes = feature_store::hashing::read_file_bytes(image_path);
+                if (not encoded_bytes.has_value()) {
+                    return {.path = image_path, .pixel_transform = pixel_transform};
+                }
+                const feature_store::FeatureKey key {
+                    .content_hash = feature_store::hashing::fnv1a(std::span<const std::uint8_t>{*encoded_bytes}),
+                    .params_hash = decode_policy_.cache_fingerprint(extractor_fingerprint_)
+                };
+                if (auto cached = feature_store_->load(key); cached.has_value()) {
+                    return {
+                        .path = image_path,
+                        .pixel_transform = pixel_transform,
+                        .feature_key = key,
+                        .features = std::move(cached)
+                    };
+                }
                 return {
                     .path = image_path,
-                    .image = cv::imread(image_path, cv::IMREAD_COLOR)
+                    .image = decode_policy_.decode(*encoded_bytes),
+                    .pixel_transform = pixel_transform,
+                    .feature_key = key
                 };
             };
         };
@@ -226,6 +397,119 @@ namespace motion::utils {
             }
         }
 
+        /**
+         * A dataset of `size` empty samples whose path is their index, so shards can be checked without images
+         */
+        class IndexDataSet final : public dataloader::Dataset {
+            std::size_t size_;
+            decoding::DecodePolicy decode_policy_ {};
+
+        public:
+            explicit IndexDataSet(const std::size_t size) : size_(size) {
+            }
+
+            auto size() -> std::size_t override {
+                return size_;
+            }
+
+            auto get_item(const std::size_t idx) -> dataloader::ImageSample override {
+                return {.path = std::to_string(idx)};
+            }
+
+            auto decode_policy() const -> const decoding::DecodePolicy& override {
+                return decode_policy_;
+            }
+
+            auto set_decode_policy(decoding::DecodePolicy decode_policy) -> void override {
+                decode_policy_ = std::move(decode_policy);
+            }
+
+            auto attach_feature_store(std::shared_ptr<feature_store::FeatureStore>, std::uint64_t) -> IndexDataSet& override {
+                return *this;
+            }
+        };
+
+        /**
+         * Simulates `world_size` processes over a dataset that does not split evenly: for both shard modes the ranks
+         * cover every epoch exactly once, drop_last / pad give every rank the same share, loaders built with the same
+         * seed agree and iterating a loader visits exactly indexes_for_epoch()
+         */
+        inline auto test_sharded_batches(const std::size_t world_size = 4, const std::uint64_t seed = 42, const std::size_t dataset_size = 23) -> void {
+            using Loader = dataloader::DataLoader<dataloader::ImageSample, dataloader::ImageBatch>;
+            const auto dataset = std::make_shared<IndexDataSet>(dataset_size);
+            constexpr std::size_t BATCH_SIZE {4};
+            bool passed {true};
+            auto check = [&](const bool condition, const std::string& what) {
+                if (not condition) {
+                    std::cout << RED << what << " failed" << RESET << std::endl;
+                    passed = false;
+                }
+            };
+
+            for (const auto mode : {dataloader::ShardMode::Contiguous, dataloader::ShardMode::Strided}) {
+                const std::string mode_name = mode == dataloader::ShardMode::Contiguous ? "contiguous" : "strided";
+                for (std::size_t epoch = 0; epoch < 2; ++epoch) {
+                    const std::string context = mode_name + " epoch " + std::to_string(epoch) + " ";
+                    std::vector<std::size_t> covered, covered_dropped, covered_padded;
+                    for (std::size_t rank = 0; rank < world_size; ++rank) {
+                        const dataloader::ShardOptions shard {.rank = rank, .world_size = world_size, .mode = mode};
+                        const auto indexes = Loader{dataset, BATCH_SIZE, true, seed, shard}.indexes_for_epoch(epoch);
+                        covered.insert(covered.end(), indexes.begin(), indexes.end());
+
+                        const auto dropped = Loader{dataset, BATCH_SIZE, true, seed, {.rank = rank, .world_size = world_size, .mode = mode, .drop_last = true}}
+                            .indexes_for_epoch(epoch);
+                        check(dropped.size() == dataset_size / world_size, context + "drop_last size of rank " + std::to_string(rank));
+                        covered_dropped.insert(covered_dropped.end(), dropped.begin(), dropped.end());
+
+                        const auto padded = Loader{dataset, BATCH_SIZE, true, seed, {.rank = rank, .world_size = world_size, .mode = mode, .pad = true}}
+                            .indexes_for_epoch(epoch);
+                        check(padded.size() == (dataset_size + world_size - 1) / world_size, context + "pad size of rank " + std::to_string(rank));
+                        covered_padded.insert(covered_padded.end(), padded.begin(), padded.end());
+                    }
+                    std::ranges::sort(covered);
+                    std::vector<std::size_t> every_index(dataset_size);
+                    std::iota(every_index.begin(), every_index.end(), std::size_t{0});
+                    check(covered == every_index, context + "disjoint coverage");
+
+                    std::ranges::sort(covered_dropped);
+                    check(std::ranges::adjacent_find(covered_dropped) == covered_dropped.end(), context + "drop_last disjoint");
+                    std::ranges::sort(covered_padded);
+                    const auto [unique_end, _] = std::ranges::unique(covered_padded);
+                    covered_padded.erase(unique_end, covered_padded.end());
+                    check(covered_padded == every_index, context + "pad coverage");
+                }
+            }
+
+            const dataloader::ShardOptions shard {.rank = 1, .world_size = world_size};
+            Loader loader{dataset, BATCH_SIZE, true, seed, shard};
+            const Loader same_seed_loader{dataset, BATCH_SIZE, true, seed, shard};
+            // Two shuffles of a handful of samples may legitimately coincide
+            if (dataset_size >= 10) {
+                const auto first_order = dataloader::epoch_permutation(dataset_size, seed, 0, true);
+                check(first_order != dataloader::epoch_permutation(dataset_size, seed, 1, true), "reshuffle between epochs");
+                check(first_order != dataloader::epoch_permutation(dataset_size, seed + 1, 0, true), "seed changes the order");
+            }
+            for (const std::size_t epoch : {std::size_t{3}, std::size_t{0}}) {
+                check(loader.indexes_for_epoch(epoch) == same_seed_loader.indexes_for_epoch(epoch), "same seed order of epoch " + std::to_string(epoch));
+
+                loader.set_epoch(epoch);
+                std::vector<std::size_t> iterated;
+                std::size_t num_batches {0};
+                for (const dataloader::ImageBatch& batch : loader) {
+                    check(not batch.empty() and batch.size() <= BATCH_SIZE, "batch size");
+                    for (const dataloader::ImageSample& sample : batch) {
+                        iterated.push_back(std::stoul(sample.path));
+                    }
+                    ++num_batches;
+                }
+                check(iterated == same_seed_loader.indexes_for_epoch(epoch), "iteration order of epoch " + std::to_string(epoch));
+                check(num_batches == loader.num_batches(), "batch count of epoch " + std::to_string(epoch));
+                check(loader.epoch() == epoch + 1, "begin() advances the epoch");
+            }
+
+            std::cout << (passed ? GREEN + "sharded batches ok" : RED + "sharded batches FAILED") << RESET << std::endl;
+        }
+
     }
 }
 
@@ -0,0 +1,206 @@
+#ifndef DECODE_POLICY_HPP
+#define DECODE_POLICY_HPP
+#include <bits/stdc++.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "feature_store.hpp"
+#include "../geometry/geometry_core.hpp"
+
+namespace motion::utils::decoding {
+    enum class ColourMode : std::uint8_t {
+        Colour,
+        Grayscale,
+        Unchanged
+    };
+
+    /**
+     * Downscale factor applied by the codec itself (IMREAD_REDUCED_*), the full resolution image is never built
+     */
+    enum class Reduction : std::uint8_t {
+        None = 1,
+        Half = 2,
+        Quarter = 4,
+        Eighth = 8
+    };
+
+    constexpr int KEEP_DEPTH {-1};
+
+    /**
+     * Relates decoded pixels to full resolution pixels for reduced and cropped decodes. Pixel centres sit on
+     * integer coordinates, as in OpenCV: full = (decoded + offset + 0.5) * scale - 0.5
+     */
+    struct PixelTransform {
+        double scale {1.0};             // Full resolution pixels per decoded pixel
+        cv::Point2d offset {0.0, 0.0};  // Top left corner of the crop, in reduced pixels
+
+        [[nodiscard]]
+        auto is_identity() const -> bool {
+            return scale == 1.0 and offset == cv::Point2d{0.0, 0.0};
+        }
+
+        [[nodiscard]]
+        auto to_full(const cv::Point2d& decoded) const -> cv::Point2d {
+            return {(decoded.x + offset.x + 0.5) * scale - 0.5, (decoded.y + offset.y + 0.5) * scale - 0.5};
+        }
+
+        [[nodiscard]]
+        auto to_decoded(const cv::Point2d& full) const -> cv::Point2d {
+            return {(full.x + 0.5) / scale - 0.5 - offset.x, (full.y + 0.5) / scale - 0.5 - offset.y};
+        }
+
+        /**
+         * Intrinsics that project straight into the decoded image, given the full resolution calibration
+         */
+        [[nodiscard]]
+        auto adjust(const geometry::PinholeCamera& full_resolution) const -> geometry::PinholeCamera {
+            const cv::Point2d principal_point = to_decoded(full_resolution.principal_point());
+            return {full_resolution.fx / scale, full_resolution.fy / scale, principal_point.x, principal_point.y};
+        }
+    };
+
+    /**
+     * Describes how an encoded image becomes a cv::Mat. Everything that can be done by the codec is folded into the
+     * imread flags, the rest (region of interest, pixel type) is applied straight after decoding.
+     */
+    struct DecodePolicy {
+        ColourMode colour_mode {ColourMode::Colour};
+        Reduction reduction {Reduction::None};
+        std::optional<cv::Rect> region_of_interest {std::nullopt}; // In full resolution pixel coordinates
+        int target_depth {KEEP_DEPTH};                             // CV_8U, CV_32F ... or KEEP_DEPTH
+        double scale {1.0};                                        // Applied together with the depth conversion
+
+        static auto colour() -> DecodePolicy {
+            return {};
+        }
+
+        static auto grayscale(const Reduction reduction = Reduction::None) -> DecodePolicy {
+            return {.colour_mode = ColourMode::Grayscale, .reduction = reduction};
+        }
+
+        [[nodiscard]]
+        auto reduction_factor() const -> int {
+            return static_cast<int>(reduction);
+        }
+
+        [[nodiscard]]
+        auto imread_flags() const -> int {
+            switch (colour_mode) {
+                case ColourMode::Grayscale:
+                    switch (reduction) {
+                        case Reduction::Half: return cv::IMREAD_REDUCED_GRAYSCALE_2;
+                        case Reduction::Quarter: return cv::IMREAD_REDUCED_GRAYSCALE_4;
+                        case Reduction::Eighth: return cv::IMREAD_REDUCED_GRAYSCALE_8;
+                        case Reduction::None: return cv::IMREAD_GRAYSCALE;
+                    }
+                    break;
+                case ColourMode::Colour:
+                    switch (reduction) {
+                        case Reduction::Half: return cv::IMREAD_REDUCED_COLOR_2;
+                        case Reduction::Quarter: return cv::IMREAD_REDUCED_COLOR_4;
+                        case Reduction::Eighth: return cv::IMREAD_REDUCED_COLOR_8;
+                        case Reduction::None: return cv::IMREAD_COLOR;
+                    }
+                    break;
+                case ColourMode::Unchanged:
+                    return cv::IMREAD_UNCHANGED;
+            }
+            return cv::IMREAD_COLOR;
+        }
+
+        /**
+         * Folded into feature store keys: features decoded under different policies never alias
+         */
+        [[nodiscard]]
+        auto fingerprint() const -> std::uint64_t {
+            using feature_store::hashing::combine;
+            std::uint64_t hash = combine(combine(0ULL, static_cast<int>(colour_mode)), reduction_factor());
+            if (region_of_interest.has_value()) {
+                const cv::Rect& roi = *region_of_interest;
+                hash = combine(combine(combine(combine(hash, roi.x), roi.y), roi.width), roi.height);
+            }
+            return combine(combine(hash, target_depth), scale);
+        }
+
+        /**
+         * Where decoded pixels come from in the full resolution image; mirrors the crop done by apply()
+         */
+        [[nodiscard]]
+        auto pixel_transform() const -> PixelTransform {
+            const int factor = reduction_factor();
+            PixelTransform transform {.scale = static_cast<double>(factor)};
+            if (region_of_interest.has_value()) {
+                transform.offset = {
+                    static_cast<double>(std::max(0, region_of_interest->x / factor)),
+                    static_cast<double>(std::max(0, region_of_interest->y / factor))
+                };
+            }
+            return transform;
+        }
+
+        /**
+         * Full resolution calibration -> intrinsics of the images this policy decodes. Keypoints extracted from
+         * decoded images must be paired with these, never with the calibration file values.
+         */
+        [[nodiscard]]
+        auto adjust(const geometry::PinholeCamera& full_resolution) const -> geometry::PinholeCamera {
+            return pixel_transform().adjust(full_resolution);
+        }
+
+        [[nodiscard]]
+        auto cache_fingerprint(const std::uint64_t extractor_fingerprint) const -> std::uint64_t {
+            return feature_store::hashing::combine(extractor_fingerprint, fingerprint());
+        }
+
+        /**
+         * Crops and converts a freshly decoded image. The region of interest is rescaled to the reduced resolution,
+         * see pixel_transform() for the resulting coordinate frame.
+         */
+        [[nodiscard]]
+        auto apply(cv::Mat decoded) const -> cv::Mat {
+            if (decoded.empty()) {
+                return decoded;
+            }
+            // IMREAD_UNCHANGED has no reduced variant, so that one is downscaled after the fact
+            if (colour_mode == ColourMode::Unchanged and reduction != Reduction::None) {
+                cv::Mat resized;
+                const double factor = 1.0 / reduction_factor();
+                cv::resize(decoded, resized, cv::Size(), factor, factor, cv::INTER_AREA);
+                decoded = resized;
+            }
+            if (region_of_interest.has_value()) {
+                const int factor = reduction_factor();
+                const cv::Rect scaled_roi {
+                    region_of_interest->x / factor,
+                    region_of_interest->y / factor,
+                    region_of_interest->width / factor,
+                    region_of_interest->height / factor
+                };
+                decoded = decoded(scaled_roi & cv::Rect(0, 0, decoded.cols, decoded.rows));
+            }
+            const bool converts = (target_depth != KEEP_DEPTH and target_depth != decoded.depth()) or scale != 1.0;
+            if (not converts and decoded.isSubmatrix()) {
+                // A crop is a view that keeps the whole frame alive, datasets and batches only hold the region
+                return decoded.clone();
+            }
+            if (converts) {
+                cv::Mat converted;
+                decoded.convertTo(converted, target_depth == KEEP_DEPTH ? decoded.depth() : target_depth, scale);
+                decoded = converted;
+            }
+            return decoded;
+        }
+
+        [[nodiscard]]
+        auto decode(const std::string& path) const -> cv::Mat {
+            return apply(cv::imread(path, imread_flags()));
+        }
+
+        [[nodiscard]]
+        auto decode(const std::vector<std::uint8_t>& encoded_bytes) const -> cv::Mat {
+            return apply(cv::imdecode(encoded_bytes, imread_flags()));
+        }
+    };
+}
+
+#endif //DECODE_POLICY_HPP
@@ -0,0 +1,452 @@
+#ifndef FEATURE_STORE_HPP
+#define FEATURE_STORE_HPP
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <opencv2/core.hpp>
+#include "pprint_utils.hpp"
+
+namespace motion::utils::feature_store {
+    struct ImageFeatures {
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat descriptors;
+    };
+
+    namespace hashing {
+        constexpr std::uint64_t FNV_OFFSET_BASIS {0xcbf29ce484222325ULL};
+        constexpr std::uint64_t FNV_PRIME {0x100000001b3ULL};
+
+        constexpr auto fnv1a(const std::span<const std::uint8_t> bytes, std::uint64_t seed = FNV_OFFSET_BASIS) noexcept -> std::uint64_t {
+            for (const std::uint8_t byte : bytes) {
+                seed ^= byte;
+                seed *= FNV_PRIME;
+            }
+            return seed;
+        }
+
+        constexpr auto fnv1a(const std::string_view text, const std::uint64_t seed = FNV_OFFSET_BASIS) noexcept -> std::uint64_t {
+            std::uint64_t hash {seed};
+            for (const char c : text) {
+                hash ^= static_cast<std::uint8_t>(c);
+                hash *= FNV_PRIME;
+            }
+            return hash;
+        }
+
+        constexpr auto combine(const std::uint64_t seed, const std::uint64_t value) noexcept -> std::uint64_t {
+            return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+        }
+
+        template<typename T> requires std::is_arithmetic_v<T>
+        auto combine(const std::uint64_t seed, const T value) noexcept -> std::uint64_t {
+            std::array<std::uint8_t, sizeof(T)> bytes{};
+            std::memcpy(bytes.data(), &value, sizeof(T));
+            return combine(seed, fnv1a(std::span<const std::uint8_t>{bytes}));
+        }
+
+        inline auto read_file_bytes(const std::filesystem::path& path) -> std::optional<std::vector<std::uint8_t>> {
+            std::ifstream input_file_stream(path, std::ios::binary | std::ios::ate);
+            if (!input_file_stream.is_open()) {
+                return std::nullopt;
+            }
+            const auto file_size = static_cast<std::size_t>(input_file_stream.tellg());
+            std::vector<std::uint8_t> bytes(file_size);
+            input_file_stream.seekg(0);
+            input_file_stream.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(file_size));
+            return bytes;
+        }
+    }
+
+    /**
+     * Identifies one set of features: the hash of the encoded image bytes plus a fingerprint of everything that
+     * influences extraction (backend, its parameters, decode settings)
+     */
+    struct FeatureKey {
+        std::uint64_t content_hash;
+        std::uint64_t params_hash;
+
+        auto operator==(const FeatureKey&) const -> bool = default;
+    };
+
+    struct FeatureKeyHash {
+        auto operator()(const FeatureKey& key) const noexcept -> std::size_t {
+            return static_cast<std::size_t>(hashing::combine(key.content_hash, key.params_hash));
+        }
+    };
+
+    namespace layout {
+        constexpr std::array<char, 8> MAGIC {'S', 'F', 'M', 'F', 'E', 'A', 'T', '\0'};
+        constexpr std::uint32_t VERSION {1};
+        constexpr std::uint64_t RECORD_ALIGNMENT {16};
+
+        struct FileHeader {
+            std::array<char, 8> magic;
+            std::uint32_t version;
+            std::uint32_t reserved;
+            std::uint64_t index_offset;
+            std::uint64_t entry_count;
+        };
+
+        struct IndexEntry {
+            std::uint64_t content_hash;
+            std::uint64_t params_hash;
+            std::uint64_t offset;
+            std::uint32_t keypoint_count;
+            std::uint32_t descriptor_rows;
+            std::uint32_t descriptor_cols;
+            std::int32_t descriptor_type;
+        };
+
+        struct KeypointRecord {
+            float x, y, size, angle, response;
+            std::int32_t octave;
+            std::int32_t class_id;
+        };
+
+        static_assert(sizeof(FileHeader) == 32 and std::is_trivially_copyable_v<FileHeader>);
+        static_assert(sizeof(IndexEntry) == 40 and std::is_trivially_copyable_v<IndexEntry>);
+        static_assert(sizeof(KeypointRecord) == 28 and std::is_trivially_copyable_v<KeypointRecord>);
+
+        constexpr auto align_up(const std::uint64_t offset) noexcept -> std::uint64_t {
+            return (offset + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+        }
+
+        inline auto descriptor_bytes(const IndexEntry& entry) noexcept -> std::uint64_t {
+            return static_cast<std::uint64_t>(entry.descriptor_rows) * entry.descriptor_cols * CV_ELEM_SIZE(entry.descriptor_type);
+        }
+
+        /**
+         * Whether the record an entry points at lies inside [sizeof(FileHeader), data_end). Every term is bounded
+         * before it is used, so a garbage entry cannot overflow the arithmetic.
+         */
+        inline auto record_fits(const IndexEntry& entry, const std::uint64_t data_end) noexcept -> bool {
+            constexpr std::uint32_t MAX_DESCRIPTOR_COLS {1u << 16};
+            if (entry.offset < sizeof(FileHeader) or entry.offset >= data_end or entry.offset % RECORD_ALIGNMENT != 0) {
+                return false;
+            }
+            if (entry.descriptor_type != CV_8UC1 and entry.descriptor_type != CV_32FC1) {
+                return false;
+            }
+            if (entry.descriptor_cols > MAX_DESCRIPTOR_COLS or entry.keypoint_count > data_end / sizeof(KeypointRecord)) {
+                return false;
+            }
+            const std::uint64_t descriptor_offset = align_up(entry.offset + entry.keypoint_count * sizeof(KeypointRecord));
+            return descriptor_offset <= data_end
+                and entry.descriptor_rows <= (data_end - descriptor_offset) / std::max<std::uint64_t>(1, entry.descriptor_cols)
+                and descriptor_offset + descriptor_bytes(entry) <= data_end;
+        }
+    }
+
+    /**
+     * Persistent, append-only feature cache. One file per dataset holds every image's keypoints and descriptors
+     * followed by an index keyed by FeatureKey. The file is memory mapped for reading, new entries are buffered
+     * in memory and appended on flush().
+     *
+     * File layout: FileHeader | record ... | IndexEntry[entry_count] (at header.index_offset)
+     * flush() never overwrites live bytes: records and a fresh index go after the end of the file and the header
+     * is switched over last, so a crash mid flush leaves the previous index valid. Superseded indexes stay in the
+     * file as dead bytes.
+     * Record layout: KeypointRecord[keypoint_count] | padding | descriptor rows (row major, 16 byte aligned)
+     */
+    class FeatureStore {
+        std::filesystem::path path_;
+        const std::uint8_t* mapping_ {nullptr};
+        std::size_t mapping_size_ {0};
+        layout::FileHeader header_{};
+        std::unordered_map<FeatureKey, layout::IndexEntry, FeatureKeyHash> index_;
+        std::unordered_map<FeatureKey, ImageFeatures, FeatureKeyHash> pending_;
+        mutable std::mutex mutex_;
+
+    public:
+        explicit FeatureStore(std::filesystem::path path): path_(std::move(path)) {
+            map_file();
+        }
+
+        FeatureStore(const FeatureStore&) = delete;
+        auto operator=(const FeatureStore&) -> FeatureStore& = delete;
+
+        ~FeatureStore() {
+            try {
+                flush();
+            } catch (const std::exception& e) {
+                std::cerr << utils::RED << "Failed to flush feature store : " << e.what() << utils::RESET << std::endl;
+            }
+            unmap_file();
+        }
+
+        [[nodiscard]]
+        auto path() const -> const std::filesystem::path& {
+            return path_;
+        }
+
+        [[nodiscard]]
+        auto size() const -> std::size_t {
+            std::scoped_lock lock(mutex_);
+            return index_.size() + pending_.size();
+        }
+
+        [[nodiscard]]
+        auto contains(const FeatureKey& key) const -> bool {
+            std::scoped_lock lock(mutex_);
+            return index_.contains(key) or pending_.contains(key);
+        }
+
+        /**
+         * Returns a copy of the cached features, or nullopt when the key has never been stored
+         */
+        [[nodiscard]]
+        auto load(const FeatureKey& key) const -> std::optional<ImageFeatures> {
+            std::scoped_lock lock(mutex_);
+            if (const auto pending_it = pending_.find(key); pending_it != pending_.end()) {
+                return ImageFeatures{
+                    .keypoints = pending_it->second.keypoints,
+                    .descriptors = pending_it->second.descriptors.clone()
+                };
+            }
+            const auto index_it = index_.find(key);
+            if (index_it == index_.end()) {
+                return std::nullopt;
+            }
+            const layout::IndexEntry& entry = index_it->second;
+            if (not layout::record_fits(entry, mapping_size_)) {
+                throw std::runtime_error("Feature store entry points outside " + path_.string());
+            }
+            const std::uint8_t* record = mapping_ + entry.offset;
+
+            ImageFeatures features;
+            features.keypoints.resize(entry.keypoint_count);
+            for (std::uint32_t i = 0; i < entry.keypoint_count; ++i) {
+                layout::KeypointRecord keypoint_record{};
+                std::memcpy(&keypoint_record, record + i * sizeof(layout::KeypointRecord), sizeof(layout::KeypointRecord));
+                features.keypoints[i] = cv::KeyPoint(
+                    cv::Point2f{keypoint_record.x, keypoint_record.y},
+                    keypoint_record.size,
+                    keypoint_record.angle,
+                    keypoint_record.response,
+                    keypoint_record.octave,
+                    keypoint_record.class_id
+                );
+            }
+            if (entry.descriptor_rows > 0) {
+                const std::uint64_t descriptor_offset = layout::align_up(entry.offset + entry.keypoint_count * sizeof(layout::KeypointRecord)) - entry.offset;
+                features.descriptors = cv::Mat(
+                    static_cast<int>(entry.descriptor_rows),
+                    static_cast<int>(entry.descriptor_cols),
+                    entry.descriptor_type,
+                    const_cast<std::uint8_t*>(record + descriptor_offset)
+                ).clone();
+            }
+            return features;
+        }
+
+        /**
+         * Buffers features for the key; they are persisted by the next flush(). Thread safe.
+         */
+        auto insert(const FeatureKey& key, const ImageFeatures& features) -> void {
+            std::scoped_lock lock(mutex_);
+            if (index_.contains(key)) {
+                return;
+            }
+            pending_.insert_or_assign(key, ImageFeatures{
+                .keypoints = features.keypoints,
+                .descriptors = features.descriptors.isContinuous() ? features.descriptors : features.descriptors.clone()
+            });
+        }
+
+        /**
+         * Appends pending records and a new index at the end of the file, then points the header at that index
+         * and remaps the file
+         */
+        auto flush() -> void {
+            std::scoped_lock lock(mutex_);
+            if (pending_.empty()) {
+                return;
+            }
+            unmap_file();
+            try {
+                append_pending();
+            } catch (...) {
+                // The header still points at the previous index, keep serving it
+                try {
+                    map_file();
+                } catch (const std::exception& e) {
+                    std::cerr << utils::RED << "Could not remap feature store : " << e.what() << utils::RESET << std::endl;
+                }
+                throw;
+            }
+            map_file();
+        }
+
+    private:
+        /**
+         * Writes pending_ behind the current end of the file and commits it; index_ / header_ only change once
+         * the new header is on disk. The file must be unmapped.
+         */
+        auto append_pending() -> void {
+            // A store is only created where there is nothing: never truncate a file this instance did not map
+            if (header_.index_offset == 0) {
+                const bool missing_or_empty = not std::filesystem::exists(path_) or std::filesystem::file_size(path_) == 0;
+                if (not missing_or_empty) {
+                    throw std::runtime_error("Refusing to overwrite " + path_.string() + ", it is not a feature store opened by this instance");
+                }
+                std::ofstream create_stream(path_, std::ios::binary | std::ios::trunc);
+                const layout::FileHeader empty_header{
+                    .magic = layout::MAGIC,
+                    .version = layout::VERSION,
+                    .reserved = 0,
+                    .index_offset = sizeof(layout::FileHeader),
+                    .entry_count = 0
+                };
+                create_stream.write(reinterpret_cast<const char*>(&empty_header), sizeof(empty_header));
+            }
+
+            std::fstream file_stream(path_, std::ios::binary | std::ios::in | std::ios::out);
+            if (!file_stream.is_open()) {
+                throw std::runtime_error("Could not open feature store " + path_.string());
+            }
+
+            std::uint64_t write_offset = std::filesystem::file_size(path_);
+            std::vector<std::uint8_t> padding(layout::RECORD_ALIGNMENT, 0);
+            auto write_padding_to = [&](const std::uint64_t target) {
+                file_stream.write(reinterpret_cast<const char*>(padding.data()), static_cast<std::streamsize>(target - write_offset));
+                write_offset = target;
+            };
+
+            auto index = index_;
+            file_stream.seekp(static_cast<std::streamoff>(write_offset));
+            for (const auto& [key, features] : pending_) {
+                write_padding_to(layout::align_up(write_offset));
+                layout::IndexEntry entry{
+                    .content_hash = key.content_hash,
+                    .params_hash = key.params_hash,
+                    .offset = write_offset,
+                    .keypoint_count = static_cast<std::uint32_t>(features.keypoints.size()),
+                    .descriptor_rows = static_cast<std::uint32_t>(features.descriptors.rows),
+                    .descriptor_cols = static_cast<std::uint32_t>(features.descriptors.cols),
+                    .descriptor_type = features.descriptors.empty() ? CV_8UC1 : features.descriptors.type()
+                };
+
+                std::vector<layout::KeypointRecord> keypoint_records;
+                keypoint_records.reserve(features.keypoints.size());
+                for (const cv::KeyPoint& keypoint : features.keypoints) {
+                    keypoint_records.push_back({
+                        keypoint.pt.x, keypoint.pt.y, keypoint.size, keypoint.angle, keypoint.response,
+                        keypoint.octave, keypoint.class_id
+                    });
+                }
+                const auto keypoint_bytes = keypoint_records.size() * sizeof(layout::KeypointRecord);
+                file_stream.write(reinterpret_cast<const char*>(keypoint_records.data()), static_cast<std::streamsize>(keypoint_bytes));
+                write_offset += keypoint_bytes;
+
+                write_padding_to(layout::align_up(write_offset));
+                const auto descriptor_bytes = layout::descriptor_bytes(entry);
+                if (descriptor_bytes > 0) {
+                    file_stream.write(reinterpret_cast<const char*>(features.descriptors.data), static_cast<std::streamsize>(descriptor_bytes));
+                    write_offset += descriptor_bytes;
+                }
+                index.insert_or_assign(key, entry);
+            }
+
+            write_padding_to(layout::align_up(write_offset));
+            layout::FileHeader header = header_;
+            header.magic = layout::MAGIC;
+            header.version = layout::VERSION;
+            header.index_offset = write_offset;
+            header.entry_count = index.size();
+            for (const auto& entry : index | std::views::values) {
+                file_stream.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            }
+            file_stream.close();
+            if (!file_stream) {
+                throw std::runtime_error("Failed writing feature store " + path_.string());
+            }
+            commit_header(header);
+
+            header_ = header;
+            index_ = std::move(index);
+            pending_.clear();
+        }
+
+        /**
+         * Makes the appended records and index durable before the header that references them is rewritten
+         */
+        auto commit_header(const layout::FileHeader& header) const -> void {
+            const int file_descriptor = ::open(path_.c_str(), O_WRONLY);
+            if (file_descriptor < 0) {
+                throw std::runtime_error("Could not open feature store " + path_.string());
+            }
+            const bool committed = ::fdatasync(file_descriptor) == 0
+                and ::pwrite(file_descriptor, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))
+                and ::fdatasync(file_descriptor) == 0;
+            ::close(file_descriptor);
+            if (not committed) {
+                throw std::runtime_error("Failed writing feature store header " + path_.string());
+            }
+        }
+
+        auto map_file() -> void {
+            if (not std::filesystem::exists(path_)) {
+                return;
+            }
+            const int file_descriptor = ::open(path_.c_str(), O_RDONLY);
+            if (file_descriptor < 0) {
+                throw std::runtime_error("Could not open feature store " + path_.string());
+            }
+            struct stat file_stat{};
+            ::fstat(file_descriptor, &file_stat);
+            mapping_size_ = static_cast<std::size_t>(file_stat.st_size);
+            if (mapping_size_ < sizeof(layout::FileHeader)) {
+                ::close(file_descriptor);
+                mapping_size_ = 0;
+                return;
+            }
+            void* mapping = ::mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+            ::close(file_descriptor);
+            if (mapping == MAP_FAILED) {
+                mapping_size_ = 0;
+                throw std::runtime_error("Could not mmap feature store " + path_.string());
+            }
+            mapping_ = static_cast<const std::uint8_t*>(mapping);
+
+            std::memcpy(&header_, mapping_, sizeof(header_));
+            const bool index_fits = header_.index_offset >= sizeof(layout::FileHeader)
+                and header_.index_offset <= mapping_size_
+                and header_.entry_count <= (mapping_size_ - header_.index_offset) / sizeof(layout::IndexEntry);
+            if (header_.magic != layout::MAGIC or header_.version != layout::VERSION or not index_fits) {
+                fail_corrupt();
+            }
+
+            index_.clear();
+            index_.reserve(header_.entry_count);
+            for (std::uint64_t i = 0; i < header_.entry_count; ++i) {
+                layout::IndexEntry entry{};
+                std::memcpy(&entry, mapping_ + header_.index_offset + i * sizeof(layout::IndexEntry), sizeof(entry));
+                // Records always precede the index that references them
+                if (not layout::record_fits(entry, header_.index_offset)) {
+                    fail_corrupt();
+                }
+                index_.insert_or_assign(FeatureKey{entry.content_hash, entry.params_hash}, entry);
+            }
+        }
+
+        [[noreturn]]
+        auto fail_corrupt() -> void {
+            unmap_file();
+            header_ = {};
+            index_.clear();
+            throw std::runtime_error("Feature store is corrupt or from another version " + path_.string());
+        }
+
+        auto unmap_file() -> void {
+            if (mapping_ != nullptr) {
+                ::munmap(const_cast<std::uint8_t*>(mapping_), mapping_size_);
+            }
+            mapping_ = nullptr;
+            mapping_size_ = 0;
+        }
+    };
+}
+
+#endif //FEATURE_STORE_HPP
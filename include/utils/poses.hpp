@@ -0,0 +1,14 @@
+#ifndef POSES_HPP
+#define POSES_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace motion::utils {
+    /**
+     * Camera to world poses of a trajectory, kept apart from the Pangolin drawing code so geometry headers stay light
+     */
+    using PosesVector = std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>>;
+}
+
+#endif //POSES_HPP
@@ -0,0 +1,186 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#include <bits/stdc++.h>
+
+namespace motion::utils::concurrency {
+
+    /**
+     * Work stealing thread pool. Every worker owns a deque: it pushes and pops its own work at the back and, once
+     * empty, steals from the front of the other workers' deques. Tasks submitted from outside the pool are dealt
+     * round robin across the deques. Waiting on pool work from inside a task helps executing tasks instead of
+     * blocking, so nested parallel_for calls cannot deadlock.
+     */
+    class ThreadPool {
+        using Task = std::move_only_function<void()>;
+
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> queues_;
+        std::vector<std::jthread> workers_;
+        std::atomic<std::size_t> next_queue_ {0};
+        std::atomic<std::size_t> queued_tasks_ {0};
+        std::mutex sleep_mutex_;
+        std::condition_variable wake_up_;
+        bool stopping_ {false};
+
+        static inline thread_local const ThreadPool* current_pool_ {nullptr};
+        static inline thread_local std::size_t current_worker_ {0};
+
+    public:
+        explicit ThreadPool(std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency())) {
+            num_threads = std::max<std::size_t>(num_threads, 1);
+            queues_.reserve(num_threads);
+            for (std::size_t i = 0; i < num_threads; ++i) {
+                queues_.push_back(std::make_unique<WorkQueue>());
+            }
+            workers_.reserve(num_threads);
+            for (std::size_t i = 0; i < num_threads; ++i) {
+                workers_.emplace_back([this, i] { worker_loop(i); });
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+        ~ThreadPool() {
+            {
+                std::scoped_lock lock(sleep_mutex_);
+                stopping_ = true;
+            }
+            wake_up_.notify_all();
+            workers_.clear();
+        }
+
+        [[nodiscard]]
+        auto size() const -> std::size_t {
+            return workers_.size();
+        }
+
+        template<typename F>
+        auto submit(F&& function) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+            using Result = std::invoke_result_t<std::decay_t<F>>;
+            std::packaged_task<Result()> task(std::forward<F>(function));
+            auto future = task.get_future();
+            push([task = std::move(task)]() mutable { task(); });
+            return future;
+        }
+
+        /**
+         * Blocks until `future` is ready; pool threads keep executing queued tasks while they wait
+         */
+        template<typename T>
+        auto wait(std::future<T>& future) -> void {
+            if (current_pool_ != this) {
+                future.wait();
+                return;
+            }
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                if (not run_one(current_worker_)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        /**
+         * Calls body(i) for every i in [begin, end), split in chunks of `grain` indexes
+         */
+        template<typename F>
+        auto parallel_for(const std::size_t begin, const std::size_t end, F&& body, std::size_t grain = 0) -> void {
+            if (begin >= end) {
+                return;
+            }
+            const std::size_t count = end - begin;
+            if (grain == 0) {
+                grain = std::max<std::size_t>(1, count / (size() * 8));
+            }
+            std::vector<std::future<void>> futures;
+            futures.reserve((count + grain - 1) / grain);
+            for (std::size_t chunk_begin = begin; chunk_begin < end; chunk_begin += grain) {
+                const std::size_t chunk_end = std::min(end, chunk_begin + grain);
+                futures.push_back(submit([&body, chunk_begin, chunk_end] {
+                    for (std::size_t i = chunk_begin; i < chunk_end; ++i) {
+                        body(i);
+                    }
+                }));
+            }
+            for (auto& future : futures) {
+                wait(future);
+            }
+            for (auto& future : futures) {
+                future.get();
+            }
+        }
+
+    private:
+        auto push(Task task) -> void {
+            const std::size_t queue_idx = current_pool_ == this
+                ? current_worker_
+                : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+            {
+                // Counted before it is visible so run_one() never decrements below zero; taking the sleep mutex
+                // orders the increment with a worker checking the predicate
+                std::scoped_lock lock(sleep_mutex_);
+                queued_tasks_.fetch_add(1, std::memory_order_release);
+            }
+            {
+                std::scoped_lock lock(queues_[queue_idx]->mutex);
+                queues_[queue_idx]->tasks.push_back(std::move(task));
+            }
+            wake_up_.notify_one();
+        }
+
+        auto try_pop(const std::size_t worker_idx) -> std::optional<Task> {
+            {
+                WorkQueue& own = *queues_[worker_idx];
+                std::scoped_lock lock(own.mutex);
+                if (not own.tasks.empty()) {
+                    Task task = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return task;
+                }
+            }
+            for (std::size_t offset = 1; offset < queues_.size(); ++offset) {
+                WorkQueue& victim = *queues_[(worker_idx + offset) % queues_.size()];
+                std::unique_lock lock(victim.mutex, std::try_to_lock);
+                if (lock.owns_lock() and not victim.tasks.empty()) {
+                    Task task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return task;
+                }
+            }
+            return std::nullopt;
+        }
+
+        auto run_one(const std::size_t worker_idx) -> bool {
+            auto task = try_pop(worker_idx);
+            if (not task.has_value()) {
+                return false;
+            }
+            queued_tasks_.fetch_sub(1, std::memory_order_acq_rel);
+            (*task)();
+            return true;
+        }
+
+        auto worker_loop(const std::size_t worker_idx) -> void {
+            current_pool_ = this;
+            current_worker_ = worker_idx;
+            while (true) {
+                if (run_one(worker_idx)) {
+                    continue;
+                }
+                std::unique_lock lock(sleep_mutex_);
+                wake_up_.wait(lock, [this] {
+                    return stopping_ or queued_tasks_.load(std::memory_order_acquire) > 0;
+                });
+                if (stopping_) {
+                    return;
+                }
+            }
+        }
+    };
+}
+
+#endif //THREAD_POOL_HPP
@@ -0,0 +1,825 @@
+#ifndef TRAJECTORY_STORAGE_HPP
+#define TRAJECTORY_STORAGE_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#ifdef SFM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "sophus/se3.hpp"
+#include "pprint_utils.hpp"
+#include "trajectory_utils.hpp"
+
+namespace motion::utils::trajectory_storage {
+
+    struct StampedPose {
+        double timestamp {0.0};                                         // Seconds, as in the TUM format
+        Eigen::Vector3d translation {Eigen::Vector3d::Zero()};
+        Eigen::Quaterniond rotation {Eigen::Quaterniond::Identity()};
+
+        static auto from(const double timestamp, const Sophus::SE3d& pose) -> StampedPose {
+            return {timestamp, pose.translation(), pose.unit_quaternion()};
+        }
+
+        [[nodiscard]]
+        auto isometry() const -> Eigen::Isometry3d {
+            Eigen::Isometry3d isometry{rotation.normalized()};
+            isometry.pretranslate(translation);
+            return isometry;
+        }
+    };
+
+    using StampedPoses = std::vector<StampedPose>;
+
+    enum class Compression : std::uint32_t {
+        None = 0,
+        Zlib = 1
+    };
+
+#ifdef SFM_HAVE_ZLIB
+    constexpr Compression DEFAULT_COMPRESSION {Compression::Zlib};
+#else
+    constexpr Compression DEFAULT_COMPRESSION {Compression::None};
+#endif
+
+    /**
+     * File layout: FileHeader | (ChunkHeader payload)* | ChunkIndexEntry[n] | Footer
+     * The footer and index are only written on close; a file whose writer died is still readable, the reader
+     * rebuilds the index by walking the chunk headers and a new writer resumes after the last complete chunk.
+     */
+    namespace layout {
+        constexpr std::array<char, 8> FILE_MAGIC {'S', 'F', 'M', 'T', 'R', 'A', 'J', '\0'};
+        constexpr std::array<char, 8> INDEX_MAGIC {'S', 'F', 'M', 'T', 'I', 'D', 'X', '\0'};
+        constexpr std::uint32_t CHUNK_MAGIC {0x4b4e4843}; // "CHNK"
+        constexpr std::uint32_t VERSION {2}; // 2 : rotation components in 1 / 65535 steps
+
+        struct FileHeader {
+            std::array<char, 8> magic;
+            std::uint32_t version;
+            std::uint32_t reserved;
+            double translation_resolution;   // Metres per quantisation step
+        };
+
+        struct ChunkHeader {
+            std::uint32_t magic;
+            std::uint32_t pose_count;
+            std::int64_t first_timestamp_us;
+            std::int64_t last_timestamp_us;
+            std::uint32_t stored_size;       // Payload bytes in the file
+            std::uint32_t raw_size;          // Payload bytes once decompressed
+            std::uint32_t compression;
+            std::uint32_t reserved;
+        };
+
+        struct ChunkIndexEntry {
+            std::int64_t first_timestamp_us;
+            std::int64_t last_timestamp_us;
+            std::uint64_t offset;            // Of the ChunkHeader
+        };
+
+        struct Footer {
+            std::uint64_t index_offset;
+            std::uint64_t chunk_count;
+            std::array<char, 8> magic;
+        };
+
+        static_assert(sizeof(FileHeader) == 24 and std::is_trivially_copyable_v<FileHeader>);
+        static_assert(sizeof(ChunkHeader) == 40 and std::is_trivially_copyable_v<ChunkHeader>);
+        static_assert(sizeof(ChunkIndexEntry) == 24 and std::is_trivially_copyable_v<ChunkIndexEntry>);
+        static_assert(sizeof(Footer) == 24 and std::is_trivially_copyable_v<Footer>);
+
+        template<typename T>
+        auto read_pod(std::istream& input_stream, T& value) -> bool {
+            return static_cast<bool>(input_stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+        }
+
+        template<typename T>
+        auto write_pod(std::ostream& output_stream, const T& value) -> void {
+            output_stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+    }
+
+    /**
+     * Chunk payload codec. Timestamps (microseconds), translations (quantised to the file resolution) and
+     * rotations are predicted from the two previous poses and only the residuals are stored as zigzag varints.
+     * Rotations use the "smallest three" encoding: the largest quaternion component is dropped (its sign made
+     * positive) and the other three are quantised to 17 bits, at most 2e-5 rad of error; the prediction restarts when
+     * the dropped component changes.
+     */
+    namespace codec {
+        constexpr double QUATERNION_COMPONENT_RANGE {0.70710678118654752440};
+        constexpr double QUATERNION_STEPS {65535.0};
+
+        inline auto to_microseconds(const double seconds) -> std::int64_t {
+            return std::llround(seconds * 1e6);
+        }
+
+        inline auto zigzag(const std::int64_t value) -> std::uint64_t {
+            return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+        }
+
+        inline auto unzigzag(const std::uint64_t value) -> std::int64_t {
+            return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+        }
+
+        inline auto put_varint(std::vector<std::uint8_t>& buffer, std::uint64_t value) -> void {
+            while (value >= 0x80) {
+                buffer.push_back(static_cast<std::uint8_t>(value | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<std::uint8_t>(value));
+        }
+
+        inline auto get_varint(std::span<const std::uint8_t>& buffer) -> std::uint64_t {
+            std::uint64_t value {0};
+            for (int shift = 0; shift < 64 and not buffer.empty(); shift += 7) {
+                const std::uint8_t byte = buffer.front();
+                buffer = buffer.subspan(1);
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("Truncated varint in trajectory chunk");
+        }
+
+        struct QuantisedRotation {
+            std::uint8_t dropped;
+            std::array<std::int64_t, 3> components;
+        };
+
+        inline auto quantise(Eigen::Quaterniond rotation) -> QuantisedRotation {
+            rotation.normalize();
+            const Eigen::Vector4d coefficients = rotation.coeffs();   // x y z w
+            Eigen::Index dropped;
+            coefficients.cwiseAbs().maxCoeff(&dropped);
+            const double sign = coefficients(dropped) < 0 ? -1.0 : 1.0;
+            QuantisedRotation quantised{.dropped = static_cast<std::uint8_t>(dropped), .components = {}};
+            for (Eigen::Index i = 0, k = 0; i < 4; ++i) {
+                if (i != dropped) {
+                    quantised.components[k++] = std::llround(sign * coefficients(i) / QUATERNION_COMPONENT_RANGE * QUATERNION_STEPS);
+                }
+            }
+            return quantised;
+        }
+
+        inline auto dequantise(const QuantisedRotation& quantised) -> Eigen::Quaterniond {
+            Eigen::Vector4d coefficients;
+            double squared_sum {0};
+            for (Eigen::Index i = 0, k = 0; i < 4; ++i) {
+                if (i != quantised.dropped) {
+                    coefficients(i) = static_cast<double>(quantised.components[k++]) / QUATERNION_STEPS * QUATERNION_COMPONENT_RANGE;
+                    squared_sum += coefficients(i) * coefficients(i);
+                }
+            }
+            coefficients(quantised.dropped) = std::sqrt(std::max(0.0, 1.0 - squared_sum));
+            return Eigen::Quaterniond{coefficients(3), coefficients(0), coefficients(1), coefficients(2)}.normalized();
+        }
+
+        /**
+         * Constant velocity predictor for one quantised channel; smooth motion leaves residuals of a few steps
+         */
+        struct PredictedChannel {
+            std::int64_t previous {0};
+            std::int64_t velocity {0};
+
+            [[nodiscard]]
+            auto predict() const -> std::int64_t {
+                return previous + velocity;
+            }
+
+            auto update(const std::int64_t value) -> void {
+                velocity = value - previous;
+                previous = value;
+            }
+        };
+
+        /**
+         * Per pose: varint(zigzag(timestamp residual) << 1 | basis changed), [dropped component], then the zigzag
+         * varint residuals of the three translation and three rotation channels
+         */
+        inline auto encode(const StampedPoses& poses, const double translation_resolution) -> std::vector<std::uint8_t> {
+            std::vector<std::uint8_t> buffer;
+            buffer.reserve(poses.size() * 12);
+            PredictedChannel timestamp {.previous = poses.empty() ? 0 : to_microseconds(poses.front().timestamp)};
+            std::array<PredictedChannel, 3> translation {};
+            std::array<PredictedChannel, 3> rotation {};
+            std::uint8_t dropped {4};
+            for (const StampedPose& pose : poses) {
+                const std::int64_t timestamp_us = to_microseconds(pose.timestamp);
+                const QuantisedRotation quantised_rotation = quantise(pose.rotation);
+                const bool basis_changed = quantised_rotation.dropped != dropped;
+                put_varint(buffer, zigzag(timestamp_us - timestamp.predict()) << 1 | static_cast<std::uint64_t>(basis_changed));
+                timestamp.update(timestamp_us);
+                if (basis_changed) {
+                    dropped = quantised_rotation.dropped;
+                    buffer.push_back(dropped);
+                    rotation = {};
+                }
+
+                for (Eigen::Index axis = 0; axis < 3; ++axis) {
+                    const std::int64_t quantised = std::llround(pose.translation(axis) / translation_resolution);
+                    put_varint(buffer, zigzag(quantised - translation[axis].predict()));
+                    translation[axis].update(quantised);
+                }
+                for (std::size_t k = 0; k < 3; ++k) {
+                    put_varint(buffer, zigzag(quantised_rotation.components[k] - rotation[k].predict()));
+                    rotation[k].update(quantised_rotation.components[k]);
+                }
+            }
+            return buffer;
+        }
+
+        inline auto decode(std::span<const std::uint8_t> buffer, const std::uint32_t pose_count, const std::int64_t first_timestamp_us,
+                           const double translation_resolution) -> StampedPoses {
+            StampedPoses poses;
+            poses.reserve(pose_count);
+            PredictedChannel timestamp {.previous = first_timestamp_us};
+            std::array<PredictedChannel, 3> translation {};
+            std::array<PredictedChannel, 3> rotation {};
+            QuantisedRotation quantised_rotation {.dropped = 4, .components = {}};
+            for (std::uint32_t i = 0; i < pose_count; ++i) {
+                const std::uint64_t tagged_timestamp = get_varint(buffer);
+                timestamp.update(timestamp.predict() + unzigzag(tagged_timestamp >> 1));
+                if ((tagged_timestamp & 1) != 0) {
+                    if (buffer.empty() or buffer.front() > 3) {
+                        throw std::runtime_error("Corrupt rotation basis in trajectory chunk");
+                    }
+                    quantised_rotation.dropped = buffer.front();
+                    buffer = buffer.subspan(1);
+                    rotation = {};
+                } else if (quantised_rotation.dropped > 3) {
+                    throw std::runtime_error("Trajectory chunk does not start with a rotation basis");
+                }
+
+                StampedPose pose{.timestamp = static_cast<double>(timestamp.previous) * 1e-6};
+                for (Eigen::Index axis = 0; axis < 3; ++axis) {
+                    translation[axis].update(translation[axis].predict() + unzigzag(get_varint(buffer)));
+                    pose.translation(axis) = static_cast<double>(translation[axis].previous) * translation_resolution;
+                }
+                for (std::size_t k = 0; k < 3; ++k) {
+                    rotation[k].update(rotation[k].predict() + unzigzag(get_varint(buffer)));
+                    quantised_rotation.components[k] = rotation[k].previous;
+                }
+                pose.rotation = dequantise(quantised_rotation);
+                poses.push_back(pose);
+            }
+            return poses;
+        }
+
+        inline auto compression_available(const Compression compression) -> bool {
+#ifdef SFM_HAVE_ZLIB
+            return compression == Compression::None or compression == Compression::Zlib;
+#else
+            return compression == Compression::None;
+#endif
+        }
+
+        inline auto compress(const std::vector<std::uint8_t>& raw, [[maybe_unused]] const Compression compression) -> std::vector<std::uint8_t> {
+#ifdef SFM_HAVE_ZLIB
+            if (compression == Compression::Zlib) {
+                uLongf compressed_size = compressBound(static_cast<uLong>(raw.size()));
+                std::vector<std::uint8_t> compressed(compressed_size);
+                if (compress2(compressed.data(), &compressed_size, raw.data(), static_cast<uLong>(raw.size()), Z_BEST_SPEED) != Z_OK) {
+                    throw std::runtime_error("zlib failed to compress a trajectory chunk");
+                }
+                compressed.resize(compressed_size);
+                return compressed;
+            }
+#endif
+            return raw;
+        }
+
+        inline auto decompress(std::vector<std::uint8_t> stored, [[maybe_unused]] const std::uint32_t raw_size, const Compression compression) -> std::vector<std::uint8_t> {
+            if (compression == Compression::None) {
+                return stored;
+            }
+#ifdef SFM_HAVE_ZLIB
+            if (compression == Compression::Zlib) {
+                std::vector<std::uint8_t> raw(raw_size);
+                uLongf decompressed_size = raw_size;
+                if (uncompress(raw.data(), &decompressed_size, stored.data(), static_cast<uLong>(stored.size())) != Z_OK
+                    or decompressed_size != raw_size) {
+                    throw std::runtime_error("Corrupt compressed trajectory chunk");
+                }
+                return raw;
+            }
+#endif
+            throw std::runtime_error("Trajectory chunk uses a compression this build does not support");
+        }
+    }
+
+    struct ChunkScan {
+        layout::FileHeader header;
+        std::vector<layout::ChunkIndexEntry> index;
+        std::uint64_t data_end;              // End of the last complete chunk
+        bool has_footer;
+    };
+
+    /**
+     * Reads the chunk index from the footer, or rebuilds it by walking the chunk headers when the footer is
+     * missing (writer still running or killed)
+     */
+    inline auto scan_chunks(const std::filesystem::path& path) -> std::optional<ChunkScan> {
+        std::ifstream input_stream(path, std::ios::binary);
+        if (!input_stream.is_open()) {
+            return std::nullopt;
+        }
+        ChunkScan scan{};
+        if (not layout::read_pod(input_stream, scan.header) or scan.header.magic != layout::FILE_MAGIC
+            or scan.header.version != layout::VERSION) {
+            return std::nullopt;
+        }
+        const auto file_size = static_cast<std::uint64_t>(std::filesystem::file_size(path));
+
+        if (file_size >= sizeof(layout::FileHeader) + sizeof(layout::Footer)) {
+            layout::Footer footer{};
+            input_stream.seekg(static_cast<std::streamoff>(file_size - sizeof(layout::Footer)));
+            if (layout::read_pod(input_stream, footer) and footer.magic == layout::INDEX_MAGIC
+                and footer.index_offset + footer.chunk_count * sizeof(layout::ChunkIndexEntry) + sizeof(layout::Footer) == file_size) {
+                scan.index.resize(footer.chunk_count);
+                input_stream.seekg(static_cast<std::streamoff>(footer.index_offset));
+                input_stream.read(reinterpret_cast<char*>(scan.index.data()), static_cast<std::streamsize>(footer.chunk_count * sizeof(layout::ChunkIndexEntry)));
+                scan.data_end = footer.index_offset;
+                scan.has_footer = true;
+                return scan;
+            }
+            input_stream.clear();
+        }
+
+        std::uint64_t offset = sizeof(layout::FileHeader);
+        input_stream.seekg(static_cast<std::streamoff>(offset));
+        layout::ChunkHeader chunk{};
+        while (offset + sizeof(layout::ChunkHeader) <= file_size and layout::read_pod(input_stream, chunk)
+               and chunk.magic == layout::CHUNK_MAGIC
+               and offset + sizeof(layout::ChunkHeader) + chunk.stored_size <= file_size) {
+            scan.index.push_back({chunk.first_timestamp_us, chunk.last_timestamp_us, offset});
+            offset += sizeof(layout::ChunkHeader) + chunk.stored_size;
+            input_stream.seekg(static_cast<std::streamoff>(offset));
+        }
+        scan.data_end = offset;
+        scan.has_footer = false;
+        return scan;
+    }
+
+    struct WriterOptions {
+        std::size_t chunk_size {4096};
+        double translation_resolution {1e-4};   // Ignored when resuming, the file's resolution is kept
+        Compression compression {DEFAULT_COMPRESSION};
+    };
+
+    /**
+     * Append only trajectory writer. append() only copies the pose into the open chunk; full chunks are handed
+     * to a background thread that encodes, compresses and writes them, so the estimator never waits on disk.
+     * Appending to an existing file resumes after its last complete chunk; any other existing file is left alone.
+     * A failed background write is rethrown by the next append(), flush() or close().
+     */
+    class TrajectoryWriter {
+        std::filesystem::path path_;
+        WriterOptions options_;
+        std::fstream output_stream_;
+        std::vector<layout::ChunkIndexEntry> index_;
+        std::uint64_t write_offset_ {0};
+
+        StampedPoses open_chunk_;
+        double last_timestamp_ {-std::numeric_limits<double>::infinity()};
+
+        std::mutex mutex_;
+        std::condition_variable work_available_;
+        std::condition_variable work_done_;
+        std::deque<StampedPoses> queued_chunks_;
+        std::size_t chunks_in_flight_ {0};
+        std::exception_ptr writer_error_;
+        bool stopping_ {false};
+        bool closed_ {false};
+        std::jthread writer_thread_;
+
+    public:
+        explicit TrajectoryWriter(std::filesystem::path path, WriterOptions options = {})
+        :   path_(std::move(path)), options_(options) {
+            if (not codec::compression_available(options_.compression)) {
+                std::cerr << YELLOW << "Requested trajectory compression is not built in, writing uncompressed" << RESET << std::endl;
+                options_.compression = Compression::None;
+            }
+            options_.chunk_size = std::max<std::size_t>(options_.chunk_size, 1);
+
+            const bool is_empty_file = std::filesystem::exists(path_) and std::filesystem::is_regular_file(path_)
+                and std::filesystem::file_size(path_) == 0;
+            const auto scan = scan_chunks(path_);
+            if (not scan.has_value() and std::filesystem::exists(path_) and not is_empty_file) {
+                throw std::runtime_error("Refusing to overwrite " + path_.string() + ", it is not a trajectory file of this version");
+            }
+            if (scan.has_value()) {
+                options_.translation_resolution = scan->header.translation_resolution;
+                index_ = scan->index;
+                write_offset_ = scan->data_end;
+                std::filesystem::resize_file(path_, write_offset_);
+                if (not index_.empty()) {
+                    last_timestamp_ = static_cast<double>(index_.back().last_timestamp_us) * 1e-6;
+                }
+                output_stream_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+                output_stream_.seekp(static_cast<std::streamoff>(write_offset_));
+            } else {
+                output_stream_.open(path_, std::ios::binary | std::ios::out | std::ios::trunc);
+                const layout::FileHeader header {
+                    .magic = layout::FILE_MAGIC,
+                    .version = layout::VERSION,
+                    .reserved = 0,
+                    .translation_resolution = options_.translation_resolution
+                };
+                layout::write_pod(output_stream_, header);
+                write_offset_ = sizeof(header);
+            }
+            if (!output_stream_) {
+                throw std::runtime_error("Could not open trajectory file " + path_.string());
+            }
+            open_chunk_.reserve(options_.chunk_size);
+            writer_thread_ = std::jthread([this] { writer_loop(); });
+        }
+
+        TrajectoryWriter(const TrajectoryWriter&) = delete;
+        auto operator=(const TrajectoryWriter&) -> TrajectoryWriter& = delete;
+
+        ~TrajectoryWriter() {
+            try {
+                close();
+            } catch (const std::exception& e) {
+                std::cerr << RED << "Failed to close trajectory file : " << e.what() << RESET << std::endl;
+            }
+        }
+
+        /**
+         * Timestamps must not decrease, the reader's time seeks rely on it
+         */
+        auto append(const StampedPose& pose) -> void {
+            if (closed_) {
+                throw std::logic_error("append() on a closed TrajectoryWriter " + path_.string());
+            }
+            if (pose.timestamp < last_timestamp_) {
+                throw std::invalid_argument("Trajectory timestamps must be non decreasing");
+            }
+            last_timestamp_ = pose.timestamp;
+            open_chunk_.push_back(pose);
+            if (open_chunk_.size() >= options_.chunk_size) {
+                hand_off_open_chunk();
+            }
+        }
+
+        auto append(const double timestamp, const Sophus::SE3d& pose) -> void {
+            append(StampedPose::from(timestamp, pose));
+        }
+
+        /**
+         * Writes the partially filled chunk and waits until everything appended so far is on disk
+         */
+        auto flush() -> void {
+            if (closed_) {
+                throw std::logic_error("flush() on a closed TrajectoryWriter " + path_.string());
+            }
+            drain();
+        }
+
+        /**
+         * Flushes, stops the background thread and appends the chunk index and footer. The thread is stopped
+         * even when a write failed; the error is rethrown afterwards and no footer is written, so readers rebuild
+         * the index from the chunks that made it to disk.
+         */
+        auto close() -> void {
+            if (closed_) {
+                return;
+            }
+            closed_ = true;
+            std::exception_ptr error;
+            try {
+                drain();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::scoped_lock lock(mutex_);
+                stopping_ = true;
+            }
+            work_available_.notify_all();
+            writer_thread_ = {};
+            if (error) {
+                output_stream_.close();
+                std::rethrow_exception(error);
+            }
+
+            output_stream_.seekp(static_cast<std::streamoff>(write_offset_));
+            for (const auto& entry : index_) {
+                layout::write_pod(output_stream_, entry);
+            }
+            layout::write_pod(output_stream_, layout::Footer{
+                .index_offset = write_offset_,
+                .chunk_count = index_.size(),
+                .magic = layout::INDEX_MAGIC
+            });
+            output_stream_.close();
+            if (!output_stream_) {
+                throw std::runtime_error("Failed writing the chunk index of " + path_.string());
+            }
+        }
+
+    private:
+        auto drain() -> void {
+            hand_off_open_chunk();
+            std::unique_lock lock(mutex_);
+            work_done_.wait(lock, [this] { return (queued_chunks_.empty() and chunks_in_flight_ == 0) or writer_error_; });
+            if (writer_error_) {
+                std::rethrow_exception(writer_error_);
+            }
+            output_stream_.flush();
+            if (!output_stream_) {
+                writer_error_ = std::make_exception_ptr(std::runtime_error("Failed writing trajectory chunks to " + path_.string()));
+                std::rethrow_exception(writer_error_);
+            }
+        }
+
+        auto hand_off_open_chunk() -> void {
+            if (open_chunk_.empty()) {
+                return;
+            }
+            StampedPoses full_chunk;
+            full_chunk.reserve(options_.chunk_size);
+            std::swap(full_chunk, open_chunk_);
+            {
+                std::scoped_lock lock(mutex_);
+                if (writer_error_) {
+                    std::rethrow_exception(writer_error_);
+                }
+                queued_chunks_.push_back(std::move(full_chunk));
+            }
+            work_available_.notify_one();
+        }
+
+        auto writer_loop() -> void {
+            while (true) {
+                StampedPoses chunk;
+                {
+                    std::unique_lock lock(mutex_);
+                    work_available_.wait(lock, [this] { return stopping_ or not queued_chunks_.empty(); });
+                    if (queued_chunks_.empty()) {
+                        return;
+                    }
+                    chunk = std::move(queued_chunks_.front());
+                    queued_chunks_.pop_front();
+                    if (writer_error_) {
+                        // The file ends at the last good chunk, later ones are dropped
+                        continue;
+                    }
+                    ++chunks_in_flight_;
+                }
+                try {
+                    write_chunk(chunk);
+                } catch (...) {
+                    std::scoped_lock lock(mutex_);
+                    writer_error_ = std::current_exception();
+                }
+                {
+                    std::scoped_lock lock(mutex_);
+                    --chunks_in_flight_;
+                }
+                work_done_.notify_all();
+            }
+        }
+
+        auto write_chunk(const StampedPoses& chunk) -> void {
+            const std::vector<std::uint8_t> raw = codec::encode(chunk, options_.translation_resolution);
+            const std::vector<std::uint8_t> stored = codec::compress(raw, options_.compression);
+            const layout::ChunkHeader header {
+                .magic = layout::CHUNK_MAGIC,
+                .pose_count = static_cast<std::uint32_t>(chunk.size()),
+                .first_timestamp_us = codec::to_microseconds(chunk.front().timestamp),
+                .last_timestamp_us = codec::to_microseconds(chunk.back().timestamp),
+                .stored_size = static_cast<std::uint32_t>(stored.size()),
+                .raw_size = static_cast<std::uint32_t>(raw.size()),
+                .compression = static_cast<std::uint32_t>(options_.compression),
+                .reserved = 0
+            };
+            layout::write_pod(output_stream_, header);
+            output_stream_.write(reinterpret_cast<const char*>(stored.data()), static_cast<std::streamsize>(stored.size()));
+            if (!output_stream_) {
+                throw std::runtime_error("Failed writing trajectory chunk to " + path_.string());
+            }
+            index_.push_back({header.first_timestamp_us, header.last_timestamp_us, write_offset_});
+            write_offset_ += sizeof(header) + stored.size();
+        }
+    };
+
+    /**
+     * Random access reader: only the chunks overlapping a requested time range are read and decoded
+     */
+    class TrajectoryReader {
+        std::filesystem::path path_;
+        ChunkScan scan_;
+        mutable std::ifstream input_stream_;
+
+    public:
+        explicit TrajectoryReader(std::filesystem::path path): path_(std::move(path)) {
+            auto scan = scan_chunks(path_);
+            if (not scan.has_value()) {
+                throw std::runtime_error("Not a chunked trajectory file " + path_.string());
+            }
+            scan_ = std::move(*scan);
+            input_stream_.open(path_, std::ios::binary);
+        }
+
+        [[nodiscard]]
+        auto num_chunks() const -> std::size_t {
+            return scan_.index.size();
+        }
+
+        /**
+         * False when the writer did not close the file; the index was rebuilt from the chunk headers
+         */
+        [[nodiscard]]
+        auto is_complete() const -> bool {
+            return scan_.has_footer;
+        }
+
+        [[nodiscard]]
+        auto time_range() const -> std::optional<std::pair<double, double>> {
+            if (scan_.index.empty()) {
+                return std::nullopt;
+            }
+            return std::pair{
+                static_cast<double>(scan_.index.front().first_timestamp_us) * 1e-6,
+                static_cast<double>(scan_.index.back().last_timestamp_us) * 1e-6
+            };
+        }
+
+        /**
+         * Every pose with begin <= timestamp <= end
+         */
+        [[nodiscard]]
+        auto read_range(const double begin, const double end) const -> StampedPoses {
+            StampedPoses poses;
+            const std::int64_t begin_us = codec::to_microseconds(begin);
+            const std::int64_t end_us = codec::to_microseconds(end);
+            auto chunk_it = std::ranges::lower_bound(scan_.index, begin_us, {}, &layout::ChunkIndexEntry::last_timestamp_us);
+            for (; chunk_it != scan_.index.end() and chunk_it->first_timestamp_us <= end_us; ++chunk_it) {
+                for (const StampedPose& pose : read_chunk(*chunk_it)) {
+                    const std::int64_t timestamp_us = codec::to_microseconds(pose.timestamp);
+                    if (timestamp_us >= begin_us and timestamp_us <= end_us) {
+                        poses.push_back(pose);
+                    }
+                }
+            }
+            return poses;
+        }
+
+        [[nodiscard]]
+        auto read_all() const -> StampedPoses {
+            StampedPoses poses;
+            for (const auto& entry : scan_.index) {
+                auto chunk = read_chunk(entry);
+                poses.insert(poses.end(), chunk.begin(), chunk.end());
+            }
+            return poses;
+        }
+
+    private:
+        [[nodiscard]]
+        auto read_chunk(const layout::ChunkIndexEntry& entry) const -> StampedPoses {
+            input_stream_.clear();
+            input_stream_.seekg(static_cast<std::streamoff>(entry.offset));
+            layout::ChunkHeader header{};
+            if (not layout::read_pod(input_stream_, header) or header.magic != layout::CHUNK_MAGIC) {
+                throw std::runtime_error("Corrupt chunk header in " + path_.string());
+            }
+            std::vector<std::uint8_t> stored(header.stored_size);
+            input_stream_.read(reinterpret_cast<char*>(stored.data()), static_cast<std::streamsize>(stored.size()));
+            if (!input_stream_) {
+                throw std::runtime_error("Truncated chunk in " + path_.string());
+            }
+            const auto raw = codec::decompress(std::move(stored), header.raw_size, static_cast<Compression>(header.compression));
+            return codec::decode(raw, header.pose_count, header.first_timestamp_us, scan_.header.translation_resolution);
+        }
+    };
+
+    inline auto to_poses_vector(const StampedPoses& stamped_poses) -> PosesVector {
+        PosesVector poses;
+        poses.reserve(stamped_poses.size());
+        for (const StampedPose& stamped_pose : stamped_poses) {
+            poses.push_back(stamped_pose.isometry());
+        }
+        return poses;
+    }
+
+    /**
+     * Parses a TUM text trajectory, "timestamp tx ty tz qx qy qz qw" per line
+     */
+    inline auto read_tum_trajectory(const std::filesystem::path& tum_path) -> StampedPoses {
+        std::ifstream input_file_stream(tum_path);
+        if (!input_file_stream.is_open()) {
+            throw std::runtime_error("Could not open " + tum_path.string());
+        }
+        StampedPoses poses;
+        double time, tx, ty, tz, qx, qy, qz, qw;
+        while (input_file_stream >> time >> tx >> ty >> tz >> qx >> qy >> qz >> qw) {
+            poses.push_back(StampedPose{time, Eigen::Vector3d{tx, ty, tz}, Eigen::Quaterniond{qw, qx, qy, qz}});
+        }
+        return poses;
+    }
+
+    /**
+     * Re-encodes a TUM text trajectory as a new chunked file, an existing output is never touched
+     */
+    inline auto convert_tum_trajectory(const std::filesystem::path& tum_path, const std::filesystem::path& output_path,
+                                       const WriterOptions& options = {}) -> std::size_t {
+        const StampedPoses poses = read_tum_trajectory(tum_path);
+        if (std::filesystem::exists(output_path)) {
+            throw std::runtime_error("Refusing to convert into " + output_path.string() + ", it already exists");
+        }
+        TrajectoryWriter writer(output_path, options);
+        for (const StampedPose& pose : poses) {
+            writer.append(pose);
+        }
+        writer.close();
+        return poses.size();
+    }
+
+    /**
+     * Converts the faux TUM trajectory, then writes it again in two sessions (resume after close); both files must
+     * read back every pose with its exact timestamp and within the quantisation error of the format
+     */
+    inline auto test_trajectory_storage(const std::filesystem::path& output_path = std::filesystem::temp_directory_path() / "trajectories.sfmtraj") -> void {
+        constexpr double MAX_TRANSLATION_ERROR {0.08e-3};   // Metres, per axis, translation_resolution / 2 is 0.05 mm
+        constexpr double MAX_ROTATION_ERROR {4e-5};         // Radians
+        bool passed {true};
+        auto check = [&](const bool condition, const std::string& what) {
+            if (not condition) {
+                std::cout << RED << what << " failed" << RESET << std::endl;
+                passed = false;
+            }
+        };
+        auto check_read_back = [&](const StampedPoses& expected, const StampedPoses& read, const std::string& context) {
+            check(read.size() == expected.size(), context + " : pose count " + std::to_string(read.size()) + " / " + std::to_string(expected.size()));
+            double max_translation_error {0.0}, max_rotation_error {0.0};
+            bool same_timestamps {true};
+            for (std::size_t i = 0; i < std::min(read.size(), expected.size()); ++i) {
+                same_timestamps = same_timestamps and codec::to_microseconds(read[i].timestamp) == codec::to_microseconds(expected[i].timestamp);
+                max_translation_error = std::max(max_translation_error, (read[i].translation - expected[i].translation).lpNorm<Eigen::Infinity>());
+                max_rotation_error = std::max(max_rotation_error, read[i].rotation.angularDistance(expected[i].rotation.normalized()));
+            }
+            check(same_timestamps, context + " : timestamps");
+            check(max_translation_error <= MAX_TRANSLATION_ERROR, context + " : translation error " + std::to_string(max_translation_error));
+            check(max_rotation_error <= MAX_ROTATION_ERROR, context + " : rotation error " + std::to_string(max_rotation_error));
+        };
+
+        // The output belongs to this test
+        std::filesystem::remove(output_path);
+        const StampedPoses expected = read_tum_trajectory(resources::STR_TRAJECTORY_LOCATION);
+        check(not expected.empty(), "reading " + resources::STR_TRAJECTORY_LOCATION);
+
+        const std::size_t count = convert_tum_trajectory(resources::STR_TRAJECTORY_LOCATION, output_path);
+        const auto text_size = std::filesystem::file_size(resources::STR_TRAJECTORY_LOCATION);
+        const auto chunked_size = std::filesystem::file_size(output_path);
+        std::cout << count << " poses : " << text_size << " bytes as TUM text, " << chunked_size << " bytes chunked" << std::endl;
+        check(count == expected.size(), "converted pose count");
+        {
+            const TrajectoryReader reader(output_path);
+            check(reader.is_complete(), "converted file footer");
+            check_read_back(expected, reader.read_all(), "converted");
+            if (const auto range = reader.time_range(); range.has_value() and not expected.empty()) {
+                const double middle = 0.5 * (range->first + range->second);
+                const auto window = reader.read_range(middle, middle + 1.0);
+                const auto in_window = std::ranges::count_if(expected, [&](const StampedPose& pose) {
+                    const std::int64_t timestamp_us = codec::to_microseconds(pose.timestamp);
+                    return timestamp_us >= codec::to_microseconds(middle) and timestamp_us <= codec::to_microseconds(middle + 1.0);
+                });
+                check(std::cmp_equal(window.size(), in_window), "read_range window");
+            }
+        }
+        try {
+            static_cast<void>(convert_tum_trajectory(resources::STR_TRAJECTORY_LOCATION, output_path));
+            check(false, "refusing to convert over an existing file");
+        } catch (const std::runtime_error&) {
+        }
+        std::filesystem::remove(output_path);
+
+        // Small chunks, so the second session resumes behind several of them
+        const WriterOptions options {.chunk_size = 64};
+        const auto half = expected.begin() + static_cast<std::ptrdiff_t>(expected.size() / 2);
+        for (const auto& [first, last] : {std::pair{expected.begin(), half}, std::pair{half, expected.end()}}) {
+            TrajectoryWriter writer(output_path, options);
+            for (auto pose_it = first; pose_it != last; ++pose_it) {
+                writer.append(*pose_it);
+            }
+            writer.close();
+        }
+        {
+            const TrajectoryReader reader(output_path);
+            check(reader.is_complete(), "resumed file footer");
+            check_read_back(expected, reader.read_all(), "resumed after close");
+        }
+        std::filesystem::remove(output_path);
+
+        std::cout << (passed ? GREEN + "trajectory storage ok" : RED + "trajectory storage FAILED") << RESET << std::endl;
+    }
+}
+
+#endif //TRAJECTORY_STORAGE_HPP
@@ -12,6 +12,7 @@
 #include <bits/stdc++.h>
 
 #include "pprint_utils.hpp"
+#include "poses.hpp"
 #include "sophus/geometry.hpp"
 
 namespace motion::utils {
@@ -22,7 +23,6 @@ namespace motion::utils {
     }
 
 
-    using PosesVector = std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>>;
     using TrajectoryReadResult = std::variant<PosesVector, std::string>;
 
     inline auto read_trajectory_from_disk(const std::filesystem::path& path = resources::TRAJECTORY_PATH) -> TrajectoryReadResult {
@@ -0,0 +1,411 @@
+#ifndef FEATURE_BACKENDS_HPP
+#define FEATURE_BACKENDS_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "../utils/feature_store.hpp"
+#include "../utils/decode_policy.hpp"
+#include "../utils/data_loader.hpp"
+
+#if __has_include(<opencv2/xfeatures2d.hpp>)
+#include <opencv2/xfeatures2d.hpp>
+#define VISUAL_ODOMETRY_HAS_XFEATURES2D 1
+#endif
+
+namespace visual_odometry::feature_extraction {
+
+    struct OrbTag{};
+    struct SiftTag{};
+    struct BriefTag{};
+
+    using ImageFeatures = motion::utils::feature_store::ImageFeatures;
+    namespace feature_store = motion::utils::feature_store;
+
+    /**
+     * Distance metrics used by the matching kernels. Each metric works on raw descriptor rows whose length is
+     * known at compile time, so the loops below are fully unrolled / vectorised by the compiler.
+     */
+    namespace distance {
+        template<std::size_t Bytes>
+        struct Hamming {
+            static_assert(Bytes % sizeof(std::uint64_t) == 0, "Hamming descriptors must be a multiple of 8 bytes");
+            using element_type = std::uint8_t;
+            using accumulator_type = std::uint32_t;
+
+            static auto compute(const element_type* a, const element_type* b) noexcept -> accumulator_type {
+                accumulator_type total {0};
+                for (std::size_t word = 0; word < Bytes / sizeof(std::uint64_t); ++word) {
+                    std::uint64_t lhs, rhs;
+                    std::memcpy(&lhs, a + word * sizeof(std::uint64_t), sizeof(std::uint64_t));
+                    std::memcpy(&rhs, b + word * sizeof(std::uint64_t), sizeof(std::uint64_t));
+                    total += static_cast<accumulator_type>(std::popcount(lhs ^ rhs));
+                }
+                return total;
+            }
+
+            static auto to_distance(const accumulator_type accumulated) noexcept -> float {
+                return static_cast<float>(accumulated);
+            }
+        };
+
+        template<std::size_t Dims>
+        struct SquaredL2 {
+            using element_type = float;
+            using accumulator_type = float;
+            using Vector = Eigen::Matrix<float, static_cast<int>(Dims), 1>;
+
+            static auto compute(const element_type* a, const element_type* b) noexcept -> accumulator_type {
+                return (Eigen::Map<const Vector>(a) - Eigen::Map<const Vector>(b)).squaredNorm();
+            }
+
+            /**
+             * Search runs on squared distances, the reported distance matches cv::NORM_L2
+             */
+            static auto to_distance(const accumulator_type accumulated) noexcept -> float {
+                return std::sqrt(accumulated);
+            }
+        };
+    }
+
+    struct OrbParams {
+        int n_features = 500;
+        float scale_factor = 1.2f;
+        int n_levels = 8;
+        int edge_threshold = 31;
+        int fast_threshold = 20;
+
+        [[nodiscard]]
+        auto fingerprint() const -> std::uint64_t {
+            using feature_store::hashing::combine;
+            return combine(combine(combine(combine(combine(0ULL, n_features), scale_factor), n_levels), edge_threshold), fast_threshold);
+        }
+    };
+
+    struct SiftParams {
+        int n_features = 0;
+        int n_octave_layers = 3;
+        double contrast_threshold = 0.04;
+        double edge_threshold = 10;
+        double sigma = 1.6;
+
+        [[nodiscard]]
+        auto fingerprint() const -> std::uint64_t {
+            using feature_store::hashing::combine;
+            return combine(combine(combine(combine(combine(0ULL, n_features), n_octave_layers), contrast_threshold), edge_threshold), sigma);
+        }
+    };
+
+    struct BriefParams {
+        int fast_threshold = 20;
+        bool non_max_suppression = true;
+        bool use_orientation = false;
+
+        [[nodiscard]]
+        auto fingerprint() const -> std::uint64_t {
+            using feature_store::hashing::combine;
+            return combine(combine(combine(0ULL, fast_threshold), static_cast<int>(non_max_suppression)), static_cast<int>(use_orientation));
+        }
+    };
+
+    /**
+     * Compile time description of a feature backend: descriptor layout, distance metric and how to build the
+     * OpenCV detector / descriptor extractor. Unsupported tags fail at compile time.
+     * @tparam Tag feature backend tag
+     */
+    template<typename Tag>
+    struct FeatureTraits;
+
+    template<>
+    struct FeatureTraits<OrbTag> {
+        static constexpr std::string_view name {"orb"};
+        static constexpr std::size_t descriptor_size {32};
+        static constexpr int cv_type {CV_8UC1};
+        static constexpr bool shared_detector_extractor {true};
+        using element_type = std::uint8_t;
+        using distance_type = distance::Hamming<descriptor_size>;
+        using params_type = OrbParams;
+
+        static auto create_detector(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return cv::ORB::create(
+                params.n_features,
+                params.scale_factor,
+                params.n_levels,
+                params.edge_threshold,
+                0,
+                2,
+                cv::ORB::HARRIS_SCORE,
+                31,
+                params.fast_threshold
+            );
+        }
+
+        static auto create_descriptor_extractor(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return create_detector(params);
+        }
+    };
+
+    template<>
+    struct FeatureTraits<SiftTag> {
+        static constexpr std::string_view name {"sift"};
+        static constexpr std::size_t descriptor_size {128};
+        static constexpr int cv_type {CV_32FC1};
+        static constexpr bool shared_detector_extractor {true};
+        using element_type = float;
+        using distance_type = distance::SquaredL2<descriptor_size>;
+        using params_type = SiftParams;
+
+        static auto create_detector(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return cv::SIFT::create(
+                params.n_features,
+                params.n_octave_layers,
+                params.contrast_threshold,
+                params.edge_threshold,
+                params.sigma
+            );
+        }
+
+        static auto create_descriptor_extractor(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return create_detector(params);
+        }
+    };
+
+#ifdef VISUAL_ODOMETRY_HAS_XFEATURES2D
+    template<>
+    struct FeatureTraits<BriefTag> {
+        static constexpr std::string_view name {"brief"};
+        static constexpr std::size_t descriptor_size {32};
+        static constexpr int cv_type {CV_8UC1};
+        static constexpr bool shared_detector_extractor {false};
+        using element_type = std::uint8_t;
+        using distance_type = distance::Hamming<descriptor_size>;
+        using params_type = BriefParams;
+
+        static auto create_detector(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return cv::FastFeatureDetector::create(params.fast_threshold, params.non_max_suppression);
+        }
+
+        static auto create_descriptor_extractor(const params_type& params = {}) -> cv::Ptr<cv::Feature2D> {
+            return cv::xfeatures2d::BriefDescriptorExtractor::create(
+                static_cast<int>(descriptor_size),
+                params.use_orientation
+            );
+        }
+    };
+#endif
+
+    template<typename Tag>
+    concept FeatureBackend = requires {
+        typename FeatureTraits<Tag>::element_type;
+        typename FeatureTraits<Tag>::distance_type;
+        typename FeatureTraits<Tag>::params_type;
+        { FeatureTraits<Tag>::descriptor_size } -> std::convertible_to<std::size_t>;
+        { FeatureTraits<Tag>::cv_type } -> std::convertible_to<int>;
+        { std::declval<typename FeatureTraits<Tag>::params_type>().fingerprint() } -> std::convertible_to<std::uint64_t>;
+    };
+
+    /**
+     * Brute force matcher specialised per backend. The inner loops call the backend distance directly, there is no
+     * virtual dispatch between the descriptor rows.
+     * @tparam Tag feature backend tag
+     */
+    template<FeatureBackend Tag>
+    class DescriptorMatcher {
+        using Traits = FeatureTraits<Tag>;
+        using Element = typename Traits::element_type;
+        using Distance = typename Traits::distance_type;
+        using Accumulator = typename Distance::accumulator_type;
+
+    public:
+        struct NearestTwo {
+            int best_idx {-1};
+            Accumulator best {std::numeric_limits<Accumulator>::max()};
+            Accumulator second {std::numeric_limits<Accumulator>::max()};
+        };
+
+        /**
+         * Finds the two closest rows of `train` for a single descriptor row
+         */
+        static auto nearest_two(const Element* query_row, const Element* train, const std::size_t n_train,
+                                const std::size_t train_stride) noexcept -> NearestTwo {
+            NearestTwo result{};
+            for (std::size_t j = 0; j < n_train; ++j) {
+                const Accumulator d = Distance::compute(query_row, train + j * train_stride);
+                if (d < result.best) {
+                    result.second = result.best;
+                    result.best = d;
+                    result.best_idx = static_cast<int>(j);
+                } else if (d < result.second) {
+                    result.second = d;
+                }
+            }
+            return result;
+        }
+
+        /**
+         * Matches every row of `query` to its closest row in `train`.
+         * @param max_ratio Lowe ratio test on the two nearest neighbours, 1 disables it
+         * @param cross_check only keep matches that are also nearest in the train -> query direction
+         */
+        static auto match(const cv::Mat& query, const cv::Mat& train, const float max_ratio = 1.f,
+                          const bool cross_check = false) -> std::vector<cv::DMatch> {
+            std::vector<cv::DMatch> matches;
+            if (query.empty() or train.empty()) {
+                return matches;
+            }
+            const cv::Mat query_rows = as_rows(query);
+            const cv::Mat train_rows = as_rows(train);
+            const auto* query_data = query_rows.ptr<Element>(0);
+            const auto* train_data = train_rows.ptr<Element>(0);
+            const std::size_t query_stride = query_rows.step1();
+            const std::size_t train_stride = train_rows.step1();
+
+            // Rows are independent, split them over OpenCV's parallel backend like cv::BFMatcher does
+            std::vector<NearestTwo> forward(query_rows.rows);
+            cv::parallel_for_(cv::Range(0, query_rows.rows), [&](const cv::Range& range) {
+                for (int i = range.start; i < range.end; ++i) {
+                    forward[i] = nearest_two(query_data + i * query_stride, train_data, train_rows.rows, train_stride);
+                }
+            });
+            std::vector<int> reverse_best;
+            if (cross_check) {
+                reverse_best.resize(train_rows.rows);
+                cv::parallel_for_(cv::Range(0, train_rows.rows), [&](const cv::Range& range) {
+                    for (int j = range.start; j < range.end; ++j) {
+                        reverse_best[j] = nearest_two(train_data + j * train_stride, query_data, query_rows.rows, query_stride).best_idx;
+                    }
+                });
+            }
+
+            // Ratio test on squared L2 needs the squared ratio, Hamming counts compare directly
+            const float ratio_bound = std::is_floating_point_v<Accumulator> ? max_ratio * max_ratio : max_ratio;
+            matches.reserve(query_rows.rows);
+            for (int i = 0; i < query_rows.rows; ++i) {
+                const auto [best_idx, best, second] = forward[i];
+                if (best_idx < 0) {
+                    continue;
+                }
+                if (max_ratio < 1.f and second != std::numeric_limits<Accumulator>::max()
+                    and static_cast<float>(best) >= ratio_bound * static_cast<float>(second)) {
+                    continue;
+                }
+                if (cross_check and reverse_best[best_idx] != i) {
+                    continue;
+                }
+                matches.emplace_back(i, best_idx, Distance::to_distance(best));
+            }
+            return matches;
+        }
+
+    private:
+        static auto as_rows(const cv::Mat& descriptors) -> cv::Mat {
+            if (descriptors.type() != Traits::cv_type or descriptors.cols != static_cast<int>(Traits::descriptor_size)) {
+                throw std::invalid_argument(
+                    "Descriptor layout does not match the " + std::string(Traits::name) + " backend"
+                );
+            }
+            return descriptors.isContinuous() ? descriptors : descriptors.clone();
+        }
+    };
+
+    /**
+     * Detection + description + matching for a single backend
+     * @tparam Tag feature backend tag
+     */
+    template<FeatureBackend Tag>
+    class FeaturePipeline {
+        using Traits = FeatureTraits<Tag>;
+        typename Traits::params_type params_;
+        cv::Ptr<cv::Feature2D> detector_;
+        cv::Ptr<cv::Feature2D> descriptor_extractor_;
+
+    public:
+        using tag_type = Tag;
+        using params_type = typename Traits::params_type;
+
+        explicit FeaturePipeline(const params_type& params = {})
+        :   params_(params),
+            detector_(Traits::create_detector(params)),
+            descriptor_extractor_(Traits::shared_detector_extractor ? detector_ : Traits::create_descriptor_extractor(params)) {
+        }
+
+        [[nodiscard]]
+        auto params() const -> const params_type& {
+            return params_;
+        }
+
+        [[nodiscard]]
+        auto extract(const cv::Mat& image) const -> ImageFeatures {
+            ImageFeatures features;
+            if constexpr (Traits::shared_detector_extractor) {
+                detector_->detectAndCompute(image, cv::noArray(), features.keypoints, features.descriptors);
+            } else {
+                detector_->detect(image, features.keypoints);
+                descriptor_extractor_->compute(image, features.keypoints, features.descriptors);
+            }
+            return features;
+        }
+
+        /**
+         * Identifies the extractor configuration inside a feature store key
+         */
+        [[nodiscard]]
+        auto fingerprint() const -> std::uint64_t {
+            return feature_store::hashing::combine(feature_store::hashing::fnv1a(Traits::name), params_.fingerprint());
+        }
+
+        [[nodiscard]]
+        auto feature_key(const std::uint64_t content_hash, const motion::utils::decoding::DecodePolicy& decode_policy = {}) const -> feature_store::FeatureKey {
+            return {.content_hash = content_hash, .params_hash = decode_policy.cache_fingerprint(fingerprint())};
+        }
+
+        /**
+         * Loads the features of the image at `path` from `store`, or decodes + extracts and inserts them on a miss
+         */
+        [[nodiscard]]
+        auto extract(const std::filesystem::path& path, feature_store::FeatureStore& store,
+                     const motion::utils::decoding::DecodePolicy& decode_policy = {}) const -> ImageFeatures {
+            const auto encoded_bytes = feature_store::hashing::read_file_bytes(path);
+            if (not encoded_bytes.has_value()) {
+                return {};
+            }
+            const auto key = feature_key(feature_store::hashing::fnv1a(std::span<const std::uint8_t>{*encoded_bytes}), decode_policy);
+            if (auto cached = store.load(key); cached.has_value()) {
+                return std::move(*cached);
+            }
+            auto features = extract(decode_policy.decode(*encoded_bytes));
+            store.insert(key, features);
+            return features;
+        }
+
+        /**
+         * Uses the features a cache backed dataset already attached to the sample, otherwise extracts them and
+         * records them in `store` under the sample key. Only keys made for this extractor and `decode_policy` (the
+         * one the dataset decodes with) are trusted, a dataset keyed for another extractor never leaks its features.
+         */
+        [[nodiscard]]
+        auto extract(const motion::utils::dataloader::ImageSample& sample, feature_store::FeatureStore* store = nullptr,
+                     const motion::utils::decoding::DecodePolicy& decode_policy = {}) const -> ImageFeatures {
+            const bool keyed_for_this_extractor = sample.feature_key.has_value()
+                and sample.feature_key->params_hash == decode_policy.cache_fingerprint(fingerprint());
+            if (keyed_for_this_extractor and sample.features.has_value()) {
+                return *sample.features;
+            }
+            // A foreign cache hit left the image undecoded
+            auto features = extract(sample.image.empty() ? decode_policy.decode(sample.path) : sample.image);
+            if (store != nullptr and keyed_for_this_extractor) {
+                store->insert(*sample.feature_key, features);
+            }
+            return features;
+        }
+
+        [[nodiscard]]
+        auto match(const ImageFeatures& query, const ImageFeatures& train, const float max_ratio = 1.f,
+                   const bool cross_check = false) const -> std::vector<cv::DMatch> {
+            return DescriptorMatcher<Tag>::match(query.descriptors, train.descriptors, max_ratio, cross_check);
+        }
+    };
+}
+
+#endif //FEATURE_BACKENDS_HPP
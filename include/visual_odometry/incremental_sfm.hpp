@@ -0,0 +1,707 @@
+#ifndef INCREMENTAL_SFM_HPP
+#define INCREMENTAL_SFM_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "ceres/ceres.h"
+#include "ceres/rotation.h"
+#include "sophus/se3.hpp"
+
+#include "match_graph.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/poses.hpp"
+#include "../utils/pprint_utils.hpp"
+#include "../geometry/geometry_core.hpp"
+
+namespace visual_odometry::reconstruction {
+    using matching::MatchGraph;
+
+    struct Observation {
+        std::uint32_t image;
+        std::uint32_t keypoint;
+    };
+
+    /**
+     * Feature tracks: connected components of the verified match graph, at most one keypoint per image
+     */
+    class Tracks {
+        std::vector<std::vector<Observation>> tracks_;
+        std::vector<std::vector<std::int32_t>> track_of_;
+
+    public:
+        explicit Tracks(const MatchGraph& graph) {
+            std::vector<std::uint32_t> first_observation(graph.num_images() + 1, 0);
+            for (std::size_t image = 0; image < graph.num_images(); ++image) {
+                first_observation[image + 1] = first_observation[image] + static_cast<std::uint32_t>(graph.features(image).keypoints.size());
+            }
+
+            std::vector<std::uint32_t> parent(first_observation.back());
+            std::iota(parent.begin(), parent.end(), 0u);
+            auto find = [&](std::uint32_t node) {
+                while (parent[node] != node) {
+                    parent[node] = parent[parent[node]];
+                    node = parent[node];
+                }
+                return node;
+            };
+            for (const auto& edge : graph.edges()) {
+                for (const auto& [keypoint_1, keypoint_2] : edge.inlier_matches) {
+                    const auto root_1 = find(first_observation[edge.pair.image_1] + keypoint_1);
+                    const auto root_2 = find(first_observation[edge.pair.image_2] + keypoint_2);
+                    if (root_1 != root_2) {
+                        parent[std::max(root_1, root_2)] = std::min(root_1, root_2);
+                    }
+                }
+            }
+
+            std::vector<std::uint32_t> component_size(parent.size(), 0);
+            for (std::uint32_t node = 0; node < parent.size(); ++node) {
+                ++component_size[find(node)];
+            }
+
+            // Walking observations in image order keeps tracks sorted by image; a track that revisits an image
+            // keeps its first keypoint there
+            std::vector<std::int32_t> track_of_root(parent.size(), -1);
+            std::vector<std::vector<Observation>> tracks;
+            for (std::uint32_t image = 0; image < graph.num_images(); ++image) {
+                for (std::uint32_t keypoint = 0; keypoint < first_observation[image + 1] - first_observation[image]; ++keypoint) {
+                    const std::uint32_t root = find(first_observation[image] + keypoint);
+                    if (component_size[root] < 2) {
+                        continue;
+                    }
+                    if (track_of_root[root] < 0) {
+                        track_of_root[root] = static_cast<std::int32_t>(tracks.size());
+                        tracks.emplace_back();
+                    }
+                    auto& track = tracks[track_of_root[root]];
+                    if (track.empty() or track.back().image != image) {
+                        track.push_back({image, keypoint});
+                    }
+                }
+            }
+
+            track_of_.resize(graph.num_images());
+            for (std::size_t image = 0; image < graph.num_images(); ++image) {
+                track_of_[image].assign(graph.features(image).keypoints.size(), -1);
+            }
+            for (auto& track : tracks) {
+                if (track.size() < 2) {
+                    continue;
+                }
+                const auto track_idx = static_cast<std::int32_t>(tracks_.size());
+                for (const Observation& observation : track) {
+                    track_of_[observation.image][observation.keypoint] = track_idx;
+                }
+                tracks_.push_back(std::move(track));
+            }
+        }
+
+        [[nodiscard]]
+        auto size() const -> std::size_t {
+            return tracks_.size();
+        }
+
+        [[nodiscard]]
+        auto observations(const std::size_t track_idx) const -> const std::vector<Observation>& {
+            return tracks_[track_idx];
+        }
+
+        /**
+         * Track of a keypoint, -1 when the keypoint is not part of any track
+         */
+        [[nodiscard]]
+        auto track_of(const std::size_t image, const std::size_t keypoint) const -> std::int32_t {
+            return track_of_[image][keypoint];
+        }
+    };
+
+    struct IncrementalSfMOptions {
+        motion::geometry::PinholeCamera intrinsics {motion::geometry::cameras::TUM_FREIBURG_1};   // Full resolution calibration
+        std::size_t init_candidates {32};
+        std::size_t init_min_inliers {100};
+        double init_min_triangulation_angle_deg {4.0};
+        std::size_t pnp_candidates {8};
+        std::size_t min_pnp_correspondences {20};
+        std::size_t min_pnp_inliers {15};
+        double min_pnp_inlier_ratio {0.25};
+        int pnp_ransac_iterations {1000};
+        double pnp_reprojection_error {4.0};
+        std::uint8_t max_registration_attempts {2};
+        double max_reprojection_error {4.0};
+        double min_triangulation_angle_deg {1.5};
+        double global_ba_growth {1.25};   // Global BA whenever the registered set grew by this factor
+        int ba_max_iterations {50};
+        double ba_loss_scale {1.0};
+        std::size_t num_threads {std::max(1u, std::thread::hardware_concurrency())};
+    };
+
+    struct Reconstruction {
+        std::vector<std::optional<Sophus::SE3d>> world_to_camera;
+        std::vector<Eigen::Vector3d> points;
+        std::vector<std::uint32_t> point_tracks;
+
+        [[nodiscard]]
+        auto num_registered() const -> std::size_t {
+            return std::ranges::count_if(world_to_camera, [](const auto& pose) { return pose.has_value(); });
+        }
+
+        /**
+         * Camera to world poses of the registered images in dataset order, ready for the trajectory viewers
+         */
+        [[nodiscard]]
+        auto camera_trajectory() const -> motion::utils::PosesVector {
+            motion::utils::PosesVector poses;
+            for (const auto& pose : world_to_camera) {
+                if (pose.has_value()) {
+                    poses.emplace_back(pose->inverse().matrix());
+                }
+            }
+            return poses;
+        }
+    };
+
+    namespace detail {
+        struct ReprojectionError {
+            double observed_x;
+            double observed_y;
+            motion::geometry::PinholeCamera intrinsics;
+
+            /**
+             * @param camera angle axis rotation followed by translation, world to camera
+             */
+            template<typename T>
+            bool operator()(const T* const camera, const T* const point, T* residuals) const {
+                T point_camera[3];
+                ceres::AngleAxisRotatePoint(camera, point, point_camera);
+                point_camera[0] += camera[3];
+                point_camera[1] += camera[4];
+                point_camera[2] += camera[5];
+                residuals[0] = T(intrinsics.fx) * point_camera[0] / point_camera[2] + T(intrinsics.cx) - T(observed_x);
+                residuals[1] = T(intrinsics.fy) * point_camera[1] / point_camera[2] + T(intrinsics.cy) - T(observed_y);
+                return true;
+            }
+
+            static auto create(const cv::Point2f& observed, const motion::geometry::PinholeCamera& intrinsics) -> ceres::CostFunction* {
+                return new ceres::AutoDiffCostFunction<ReprojectionError, 2, 6, 3>(
+                    new ReprojectionError{observed.x, observed.y, intrinsics}
+                );
+            }
+        };
+
+        inline auto degrees_to_radians(const double degrees) -> double {
+            return degrees * M_PI / 180.0;
+        }
+    }
+
+    /**
+     * Incremental structure from motion over a verified match graph: two view initialisation, next best view
+     * registration by PnP RANSAC, batched multi view triangulation and Ceres bundle adjustment on a geometric
+     * schedule. View scoring, PnP hypotheses, triangulation and outlier filtering run on the thread pool.
+     */
+    class IncrementalSfM {
+        const MatchGraph& graph_;
+        IncrementalSfMOptions options_;
+        motion::geometry::PinholeCamera camera_;   // options_.intrinsics in the decoded frame of the graph keypoints
+        Tracks tracks_;
+        motion::utils::concurrency::ThreadPool pool_;
+
+        std::vector<std::optional<Sophus::SE3d>> poses_;
+        std::vector<std::uint8_t> registration_attempts_;
+        std::vector<cv::Size> image_extents_;
+        std::optional<std::uint32_t> gauge_image_;      // Fixed in bundle adjustment: position and orientation
+        std::optional<std::uint32_t> scale_image_;      // Its distance to the gauge image is fixed: scale
+
+        std::vector<Eigen::Vector3d> landmarks_;
+        std::vector<std::uint32_t> landmark_tracks_;
+        std::vector<std::int32_t> landmark_of_track_;
+
+        struct ViewScore {
+            std::uint32_t image;
+            std::size_t visible;
+            std::size_t score;
+        };
+
+    public:
+        explicit IncrementalSfM(const MatchGraph& graph, IncrementalSfMOptions options = {})
+        :   graph_(graph),
+            options_(std::move(options)),
+            camera_(graph.camera(options_.intrinsics)),
+            tracks_(graph),
+            pool_(options_.num_threads),
+            poses_(graph.num_images()),
+            registration_attempts_(graph.num_images(), 0),
+            landmark_of_track_(tracks_.size(), -1) {
+            image_extents_.reserve(graph.num_images());
+            for (std::size_t image = 0; image < graph.num_images(); ++image) {
+                cv::Size extent{1, 1};
+                for (const cv::KeyPoint& keypoint : graph.features(image).keypoints) {
+                    extent.width = std::max(extent.width, static_cast<int>(keypoint.pt.x) + 1);
+                    extent.height = std::max(extent.height, static_cast<int>(keypoint.pt.y) + 1);
+                }
+                image_extents_.push_back(extent);
+            }
+        }
+
+        auto reconstruct() -> Reconstruction {
+            std::cout << motion::utils::GREEN;
+            std::cout << "Reconstructing " << graph_.num_images() << " images with " << tracks_.size() << " tracks" << std::endl;
+            std::cout << motion::utils::RESET;
+
+            if (not initialise()) {
+                std::cerr << motion::utils::RED << "No image pair is suitable for initialisation" << motion::utils::RESET << std::endl;
+                return {};
+            }
+            bundle_adjust();
+            filter_landmarks();
+            std::size_t registered_at_last_ba = num_registered();
+
+            while (true) {
+                auto candidates = next_best_views();
+                if (candidates.empty()) {
+                    break;
+                }
+                candidates.resize(std::min(candidates.size(), options_.pnp_candidates));
+
+                std::vector<std::optional<Sophus::SE3d>> hypotheses(candidates.size());
+                pool_.parallel_for(0, candidates.size(), [&](const std::size_t k) {
+                    hypotheses[k] = estimate_pose(candidates[k].image);
+                }, 1);
+
+                std::vector<std::uint32_t> registered_now;
+                for (std::size_t k = 0; k < candidates.size(); ++k) {
+                    const std::uint32_t image = candidates[k].image;
+                    ++registration_attempts_[image];
+                    if (hypotheses[k].has_value()) {
+                        poses_[image] = hypotheses[k];
+                        registered_now.push_back(image);
+                    }
+                }
+                if (registered_now.empty()) {
+                    continue;
+                }
+                triangulate_tracks_of(registered_now);
+
+                if (static_cast<double>(num_registered()) >= options_.global_ba_growth * static_cast<double>(registered_at_last_ba)) {
+                    bundle_adjust();
+                    filter_landmarks();
+                    registered_at_last_ba = num_registered();
+                }
+                std::cout << "Registered " << num_registered() << " / " << graph_.num_images()
+                          << " images, " << landmarks_.size() << " landmarks" << std::endl;
+            }
+
+            bundle_adjust();
+            filter_landmarks();
+            std::cout << motion::utils::GREEN;
+            std::cout << "Reconstruction complete : " << num_registered() << " images, " << landmarks_.size() << " landmarks" << std::endl;
+            std::cout << motion::utils::RESET;
+            return Reconstruction{
+                .world_to_camera = poses_,
+                .points = landmarks_,
+                .point_tracks = landmark_tracks_
+            };
+        }
+
+    private:
+        [[nodiscard]]
+        auto num_registered() const -> std::size_t {
+            return std::ranges::count_if(poses_, [](const auto& pose) { return pose.has_value(); });
+        }
+
+        [[nodiscard]]
+        auto pixel(const Observation& observation) const -> const cv::Point2f& {
+            return graph_.features(observation.image).keypoints[observation.keypoint].pt;
+        }
+
+        /**
+         * Picks the verified pair with the most essential matrix inliers whose median triangulation angle is
+         * large enough, then seeds the map with its triangulated tracks
+         */
+        auto initialise() -> bool {
+            std::vector<std::uint32_t> edge_order(graph_.edges().size());
+            std::iota(edge_order.begin(), edge_order.end(), 0u);
+            std::ranges::sort(edge_order, std::greater{}, [&](const std::uint32_t edge_idx) {
+                return graph_.edges()[edge_idx].inlier_matches.size();
+            });
+            edge_order.resize(std::min(edge_order.size(), options_.init_candidates));
+
+            struct InitialPair {
+                std::size_t inliers {0};
+                Sophus::SE3d relative_pose;
+            };
+            std::vector<std::optional<InitialPair>> evaluated(edge_order.size());
+            pool_.parallel_for(0, edge_order.size(), [&](const std::size_t k) {
+                const auto& edge = graph_.edges()[edge_order[k]];
+                if (edge.inlier_matches.size() < options_.init_min_inliers) {
+                    return;
+                }
+                std::vector<cv::Point2f> points_1, points_2;
+                for (const auto& [keypoint_1, keypoint_2] : edge.inlier_matches) {
+                    points_1.push_back(pixel({edge.pair.image_1, keypoint_1}));
+                    points_2.push_back(pixel({edge.pair.image_2, keypoint_2}));
+                }
+                const cv::Mat camera_matrix(camera_.to_cv());
+                std::vector<std::uint8_t> mask;
+                const cv::Mat essential = cv::findEssentialMat(points_1, points_2, camera_matrix, cv::RANSAC, 0.999, 1.0, mask);
+                if (essential.rows != 3 or essential.cols != 3) {
+                    return;
+                }
+                cv::Mat R, t;
+                const int inliers = cv::recoverPose(essential, points_1, points_2, camera_matrix, R, t, mask);
+                if (static_cast<std::size_t>(inliers) < options_.init_min_inliers) {
+                    return;
+                }
+
+                const Sophus::SE3d relative_pose = motion::geometry::cv_adapters::to_sophus(R, t);
+
+                std::vector<double> angles;
+                for (std::size_t i = 0; i < points_1.size(); ++i) {
+                    if (mask[i] == 0) {
+                        continue;
+                    }
+                    const std::array<std::pair<Sophus::SE3d, cv::Point2f>, 2> views {
+                        std::pair{Sophus::SE3d{}, points_1[i]},
+                        std::pair{relative_pose, points_2[i]}
+                    };
+                    if (const auto point = triangulate(views); point.has_value()) {
+                        angles.push_back(triangulation_angle(views, *point));
+                    }
+                }
+                if (angles.size() < options_.init_min_inliers) {
+                    return;
+                }
+                std::ranges::nth_element(angles, angles.begin() + static_cast<std::ptrdiff_t>(angles.size() / 2));
+                if (angles[angles.size() / 2] < detail::degrees_to_radians(options_.init_min_triangulation_angle_deg)) {
+                    return;
+                }
+                evaluated[k] = InitialPair{.inliers = angles.size(), .relative_pose = relative_pose};
+            }, 1);
+
+            std::optional<std::size_t> best;
+            for (std::size_t k = 0; k < evaluated.size(); ++k) {
+                if (evaluated[k].has_value() and (not best.has_value() or evaluated[k]->inliers > evaluated[*best]->inliers)) {
+                    best = k;
+                }
+            }
+            if (not best.has_value()) {
+                return false;
+            }
+            const auto& edge = graph_.edges()[edge_order[*best]];
+            poses_[edge.pair.image_1] = Sophus::SE3d{};
+            poses_[edge.pair.image_2] = evaluated[*best]->relative_pose;
+            registration_attempts_[edge.pair.image_1] = registration_attempts_[edge.pair.image_2] = 1;
+            gauge_image_ = edge.pair.image_1;
+            scale_image_ = edge.pair.image_2;
+            triangulate_tracks_of({edge.pair.image_1, edge.pair.image_2});
+            std::cout << "Initialised from images " << edge.pair.image_1 << " and " << edge.pair.image_2
+                      << " with " << landmarks_.size() << " landmarks" << std::endl;
+            return not landmarks_.empty();
+        }
+
+        /**
+         * Unregistered images ordered by how many landmarks they see and how well those cover the image
+         * (occupied cells of a 2x2, 4x4 and 8x8 grid, finer levels weighted higher)
+         */
+        [[nodiscard]]
+        auto next_best_views() -> std::vector<ViewScore> {
+            std::vector<std::optional<ViewScore>> scores(graph_.num_images());
+            pool_.parallel_for(0, graph_.num_images(), [&](const std::size_t image) {
+                if (poses_[image].has_value() or registration_attempts_[image] >= options_.max_registration_attempts) {
+                    return;
+                }
+                const auto& keypoints = graph_.features(image).keypoints;
+                const cv::Size& extent = image_extents_[image];
+                std::array<std::bitset<64>, 3> occupied{};
+                std::size_t visible {0};
+                for (std::size_t keypoint = 0; keypoint < keypoints.size(); ++keypoint) {
+                    const std::int32_t track = tracks_.track_of(image, keypoint);
+                    if (track < 0 or landmark_of_track_[track] < 0) {
+                        continue;
+                    }
+                    ++visible;
+                    for (std::size_t level = 0; level < occupied.size(); ++level) {
+                        const int cells = 2 << level;
+                        const int cell_x = std::min(cells - 1, static_cast<int>(keypoints[keypoint].pt.x) * cells / extent.width);
+                        const int cell_y = std::min(cells - 1, static_cast<int>(keypoints[keypoint].pt.y) * cells / extent.height);
+                        occupied[level].set(static_cast<std::size_t>(cell_y * cells + cell_x));
+                    }
+                }
+                if (visible < options_.min_pnp_correspondences) {
+                    return;
+                }
+                std::size_t score {0};
+                for (std::size_t level = 0; level < occupied.size(); ++level) {
+                    score += occupied[level].count() * (2u << level);
+                }
+                scores[image] = ViewScore{.image = static_cast<std::uint32_t>(image), .visible = visible, .score = score};
+            });
+
+            std::vector<ViewScore> candidates;
+            for (const auto& score : scores) {
+                if (score.has_value()) {
+                    candidates.push_back(*score);
+                }
+            }
+            std::ranges::sort(candidates, [](const ViewScore& a, const ViewScore& b) {
+                return std::tie(a.score, a.visible) > std::tie(b.score, b.visible);
+            });
+            return candidates;
+        }
+
+        [[nodiscard]]
+        auto estimate_pose(const std::uint32_t image) const -> std::optional<Sophus::SE3d> {
+            std::vector<cv::Point3d> object_points;
+            std::vector<cv::Point2d> image_points;
+            const auto& keypoints = graph_.features(image).keypoints;
+            for (std::size_t keypoint = 0; keypoint < keypoints.size(); ++keypoint) {
+                const std::int32_t track = tracks_.track_of(image, keypoint);
+                if (track < 0 or landmark_of_track_[track] < 0) {
+                    continue;
+                }
+                const Eigen::Vector3d& landmark = landmarks_[landmark_of_track_[track]];
+                object_points.emplace_back(landmark.x(), landmark.y(), landmark.z());
+                image_points.emplace_back(keypoints[keypoint].pt);
+            }
+            if (object_points.size() < options_.min_pnp_correspondences) {
+                return std::nullopt;
+            }
+
+            cv::Mat rvec, tvec;
+            std::vector<int> inliers;
+            const bool solved = cv::solvePnPRansac(
+                object_points,
+                image_points,
+                cv::Mat(camera_.to_cv()),
+                cv::noArray(),
+                rvec,
+                tvec,
+                false,
+                options_.pnp_ransac_iterations,
+                static_cast<float>(options_.pnp_reprojection_error),
+                0.999,
+                inliers,
+                cv::SOLVEPNP_ITERATIVE
+            );
+            if (not solved or inliers.size() < options_.min_pnp_inliers
+                or static_cast<double>(inliers.size()) < options_.min_pnp_inlier_ratio * static_cast<double>(object_points.size())) {
+                return std::nullopt;
+            }
+            return motion::geometry::cv_adapters::from_rodrigues(rvec, tvec);
+        }
+
+        /**
+         * Linear (DLT) triangulation on normalised image coordinates, rejected when behind a camera or when any
+         * reprojection error exceeds the threshold
+         */
+        template<typename Views>
+        [[nodiscard]]
+        auto triangulate(const Views& views) const -> std::optional<Eigen::Vector3d> {
+            Eigen::MatrixXd design(2 * std::ranges::size(views), 4);
+            Eigen::Index row {0};
+            for (const auto& [pose, observed] : views) {
+                const Eigen::Vector3d ray = camera_.unproject(observed);
+                const Eigen::Matrix<double, 3, 4> projection = pose.matrix3x4();
+                design.row(row++) = ray.x() * projection.row(2) - projection.row(0);
+                design.row(row++) = ray.y() * projection.row(2) - projection.row(1);
+            }
+            const Eigen::Vector4d homogeneous = Eigen::JacobiSVD<Eigen::MatrixXd>(design, Eigen::ComputeFullV).matrixV().col(3);
+            if (std::abs(homogeneous.w()) < 1e-12) {
+                return std::nullopt;
+            }
+            const Eigen::Vector3d point = homogeneous.head<3>() / homogeneous.w();
+            const double max_squared_error = options_.max_reprojection_error * options_.max_reprojection_error;
+            for (const auto& [pose, observed] : views) {
+                const Eigen::Vector3d point_camera = pose * point;
+                if (point_camera.z() <= 0) {
+                    return std::nullopt;
+                }
+                if ((camera_.project(point_camera) - Eigen::Vector2d{observed.x, observed.y}).squaredNorm() > max_squared_error) {
+                    return std::nullopt;
+                }
+            }
+            return point;
+        }
+
+        template<typename Views>
+        [[nodiscard]]
+        static auto triangulation_angle(const Views& views, const Eigen::Vector3d& point) -> double {
+            double max_angle {0};
+            for (auto first = std::ranges::begin(views); first != std::ranges::end(views); ++first) {
+                const Eigen::Vector3d ray_1 = point - first->first.inverse().translation();
+                for (auto second = std::next(first); second != std::ranges::end(views); ++second) {
+                    const Eigen::Vector3d ray_2 = point - second->first.inverse().translation();
+                    const double cosine = ray_1.dot(ray_2) / (ray_1.norm() * ray_2.norm());
+                    max_angle = std::max(max_angle, std::acos(std::clamp(cosine, -1.0, 1.0)));
+                }
+            }
+            return max_angle;
+        }
+
+        /**
+         * Triangulates, in one parallel batch, every track seen by `images` that has no landmark yet
+         */
+        auto triangulate_tracks_of(const std::vector<std::uint32_t>& images) -> void {
+            std::vector<std::uint32_t> candidate_tracks;
+            for (const std::uint32_t image : images) {
+                for (std::size_t keypoint = 0; keypoint < graph_.features(image).keypoints.size(); ++keypoint) {
+                    const std::int32_t track = tracks_.track_of(image, keypoint);
+                    if (track >= 0 and landmark_of_track_[track] < 0) {
+                        candidate_tracks.push_back(static_cast<std::uint32_t>(track));
+                    }
+                }
+            }
+            std::ranges::sort(candidate_tracks);
+            const auto [first, last] = std::ranges::unique(candidate_tracks);
+            candidate_tracks.erase(first, last);
+
+            const double min_angle = detail::degrees_to_radians(options_.min_triangulation_angle_deg);
+            std::vector<std::optional<Eigen::Vector3d>> triangulated(candidate_tracks.size());
+            pool_.parallel_for(0, candidate_tracks.size(), [&](const std::size_t k) {
+                std::vector<std::pair<Sophus::SE3d, cv::Point2f>> views;
+                for (const Observation& observation : tracks_.observations(candidate_tracks[k])) {
+                    if (poses_[observation.image].has_value()) {
+                        views.emplace_back(*poses_[observation.image], pixel(observation));
+                    }
+                }
+                if (views.size() < 2) {
+                    return;
+                }
+                auto point = triangulate(views);
+                if (point.has_value() and triangulation_angle(views, *point) >= min_angle) {
+                    triangulated[k] = point;
+                }
+            });
+
+            for (std::size_t k = 0; k < candidate_tracks.size(); ++k) {
+                if (triangulated[k].has_value()) {
+                    landmark_of_track_[candidate_tracks[k]] = static_cast<std::int32_t>(landmarks_.size());
+                    landmarks_.push_back(*triangulated[k]);
+                    landmark_tracks_.push_back(candidate_tracks[k]);
+                }
+            }
+        }
+
+        /**
+         * Global bundle adjustment over every registered camera and landmark. Reprojection errors are invariant to
+         * a 7 DoF similarity: the first initial camera is held fixed (rotation, translation) and the second one
+         * keeps its distance to it (scale), its translation moving on a sphere around the first camera.
+         */
+        auto bundle_adjust() -> void {
+            if (landmarks_.empty()) {
+                return;
+            }
+            std::vector<motion::geometry::AngleAxisPose> cameras(graph_.num_images());
+            for (std::size_t image = 0; image < graph_.num_images(); ++image) {
+                if (poses_[image].has_value()) {
+                    cameras[image] = motion::geometry::to_angle_axis(*poses_[image]);
+                }
+            }
+
+            ceres::Problem problem;
+            ceres::LossFunction* loss = new ceres::HuberLoss(options_.ba_loss_scale);
+            for (std::size_t landmark = 0; landmark < landmarks_.size(); ++landmark) {
+                for (const Observation& observation : tracks_.observations(landmark_tracks_[landmark])) {
+                    if (not poses_[observation.image].has_value()) {
+                        continue;
+                    }
+                    problem.AddResidualBlock(
+                        detail::ReprojectionError::create(pixel(observation), camera_),
+                        loss,
+                        cameras[observation.image].data(),
+                        landmarks_[landmark].data()
+                    );
+                }
+            }
+            if (gauge_image_.has_value() and problem.HasParameterBlock(cameras[*gauge_image_].data())) {
+                problem.SetParameterBlockConstant(cameras[*gauge_image_].data());
+            }
+            // The gauge camera is the world origin, so the baseline is the norm of the second camera translation
+            if (scale_image_.has_value() and problem.HasParameterBlock(cameras[*scale_image_].data())) {
+                using BaselineManifold = ceres::ProductManifold<ceres::EuclideanManifold<3>, ceres::SphereManifold<3>>;
+                problem.SetManifold(
+                    cameras[*scale_image_].data(),
+                    new BaselineManifold{ceres::EuclideanManifold<3>{}, ceres::SphereManifold<3>{}}
+                );
+            }
+
+            ceres::Solver::Options solver_options;
+            solver_options.linear_solver_type = num_registered() < 200 ? ceres::DENSE_SCHUR : ceres::ITERATIVE_SCHUR;
+            solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
+            solver_options.max_num_iterations = options_.ba_max_iterations;
+            solver_options.num_threads = static_cast<int>(options_.num_threads);
+            solver_options.minimizer_progress_to_stdout = false;
+            ceres::Solver::Summary summary;
+            ceres::Solve(solver_options, &problem, &summary);
+            std::cout << summary.BriefReport() << "\n";
+
+            for (std::size_t image = 0; image < graph_.num_images(); ++image) {
+                if (poses_[image].has_value()) {
+                    poses_[image] = motion::geometry::from_angle_axis(cameras[image]);
+                }
+            }
+        }
+
+        /**
+         * Drops landmarks with a large mean reprojection error or that ended up behind a camera; their tracks can
+         * be triangulated again once more images are registered
+         */
+        auto filter_landmarks() -> void {
+            const double max_squared_error = options_.max_reprojection_error * options_.max_reprojection_error;
+            std::vector<std::uint8_t> keep(landmarks_.size(), 0);
+            pool_.parallel_for(0, landmarks_.size(), [&](const std::size_t landmark) {
+                double squared_error_sum {0};
+                std::size_t count {0};
+                for (const Observation& observation : tracks_.observations(landmark_tracks_[landmark])) {
+                    if (not poses_[observation.image].has_value()) {
+                        continue;
+                    }
+                    const Eigen::Vector3d point_camera = *poses_[observation.image] * landmarks_[landmark];
+                    if (point_camera.z() <= 0) {
+                        return;
+                    }
+                    const cv::Point2f& observed = pixel(observation);
+                    squared_error_sum += (camera_.project(point_camera) - Eigen::Vector2d{observed.x, observed.y}).squaredNorm();
+                    ++count;
+                }
+                keep[landmark] = count >= 2 and squared_error_sum / static_cast<double>(count) <= max_squared_error;
+            });
+
+            std::vector<Eigen::Vector3d> kept_landmarks;
+            std::vector<std::uint32_t> kept_tracks;
+            std::ranges::fill(landmark_of_track_, -1);
+            for (std::size_t landmark = 0; landmark < landmarks_.size(); ++landmark) {
+                if (keep[landmark] != 0) {
+                    landmark_of_track_[landmark_tracks_[landmark]] = static_cast<std::int32_t>(kept_landmarks.size());
+                    kept_landmarks.push_back(landmarks_[landmark]);
+                    kept_tracks.push_back(landmark_tracks_[landmark]);
+                }
+            }
+            landmarks_ = std::move(kept_landmarks);
+            landmark_tracks_ = std::move(kept_tracks);
+        }
+    };
+
+    inline auto test_incremental_sfm(const std::string& sub_dir = "einstein_1_stereo_dataset/rgb2") -> void {
+        auto dataset = std::make_shared<motion::utils::dataset::ImagePathDataSet>(
+            motion::utils::dataset::DEFAULT_RESOURCE_DIR,
+            sub_dir,
+            motion::utils::decoding::DecodePolicy::grayscale()
+        );
+        const matching::MatchGraph match_graph = matching::MatchGraphBuilder<feature_extraction::OrbTag>(
+            dataset,
+            matching::MatchGraphOptions{.pair_selection = matching::PairSelection::Sequential}
+        ).build();
+
+        const auto start = std::chrono::steady_clock::now();
+        IncrementalSfM sfm(match_graph, IncrementalSfMOptions{.intrinsics = motion::geometry::cameras::EINSTEIN_CALIBRATION_2});
+        const Reconstruction reconstruction = sfm.reconstruct();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << reconstruction.num_registered() << " cameras, " << reconstruction.points.size()
+                  << " points in " << elapsed.count() << " ms" << std::endl;
+    }
+}
+
+#endif //INCREMENTAL_SFM_HPP
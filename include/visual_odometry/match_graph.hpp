@@ -0,0 +1,438 @@
+#ifndef MATCH_GRAPH_HPP
+#define MATCH_GRAPH_HPP
+#include <bits/stdc++.h>
+#include <Eigen/Core>
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "feature_backends.hpp"
+#include "../utils/data_loader.hpp"
+#include "../utils/decode_policy.hpp"
+#include "../utils/feature_store.hpp"
+#include "../utils/thread_pool.hpp"
+#include "../utils/pprint_utils.hpp"
+
+namespace visual_odometry::matching {
+    using feature_extraction::FeatureBackend;
+    using feature_extraction::FeatureTraits;
+    using feature_extraction::ImageFeatures;
+
+    struct ImagePair {
+        std::uint32_t image_1;
+        std::uint32_t image_2;
+
+        auto operator<=>(const ImagePair&) const = default;
+    };
+
+    enum class PairSelection {
+        Exhaustive,     // every (i, j), i < j
+        Sequential,     // i with the next `sequential_window` images, for ordered captures
+        Retrieval       // `retrieval_top_k` most similar images under a bag of visual words
+    };
+
+    struct MatchGraphOptions {
+        PairSelection pair_selection {PairSelection::Exhaustive};
+        std::size_t sequential_window {10};
+        std::size_t retrieval_top_k {20};
+        std::size_t vocabulary_size {256};
+        std::size_t vocabulary_samples_per_image {128};
+        float ratio {0.8f};
+        bool cross_check {true};
+        std::size_t min_matches {30};
+        std::size_t min_inliers {15};
+        double ransac_threshold {1.0};
+        double ransac_confidence {0.999};
+        std::size_t num_threads {std::max(1u, std::thread::hardware_concurrency())};
+    };
+
+    /**
+     * Verified geometry between two images. Inlier correspondences are stored as (keypoint index in image_1,
+     * keypoint index in image_2).
+     */
+    struct TwoViewGeometry {
+        ImagePair pair;
+        Eigen::Matrix3d fundamental {Eigen::Matrix3d::Zero()};
+        std::vector<std::array<std::uint32_t, 2>> inlier_matches {};
+    };
+
+    /**
+     * Keypoints and fundamental matrices are expressed in the decoded frame of the dataset the graph was built
+     * from; camera() converts a full resolution calibration to that frame.
+     */
+    class MatchGraph {
+        std::vector<std::string> image_paths_;
+        std::vector<ImageFeatures> features_;
+        std::vector<TwoViewGeometry> edges_;
+        std::vector<std::vector<std::uint32_t>> adjacency_;
+        motion::utils::decoding::PixelTransform pixel_transform_;
+
+    public:
+        MatchGraph(std::vector<std::string> image_paths, std::vector<ImageFeatures> features,
+                   std::vector<TwoViewGeometry> edges, const motion::utils::decoding::PixelTransform& pixel_transform = {})
+        :   image_paths_(std::move(image_paths)),
+            features_(std::move(features)),
+            edges_(std::move(edges)),
+            adjacency_(features_.size()),
+            pixel_transform_(pixel_transform) {
+            for (std::uint32_t edge_idx = 0; edge_idx < edges_.size(); ++edge_idx) {
+                adjacency_[edges_[edge_idx].pair.image_1].push_back(edge_idx);
+                adjacency_[edges_[edge_idx].pair.image_2].push_back(edge_idx);
+            }
+        }
+
+        [[nodiscard]]
+        auto num_images() const -> std::size_t {
+            return features_.size();
+        }
+
+        [[nodiscard]]
+        auto image_path(const std::size_t image_idx) const -> const std::string& {
+            return image_paths_.at(image_idx);
+        }
+
+        [[nodiscard]]
+        auto features(const std::size_t image_idx) const -> const ImageFeatures& {
+            return features_.at(image_idx);
+        }
+
+        [[nodiscard]]
+        auto edges() const -> const std::vector<TwoViewGeometry>& {
+            return edges_;
+        }
+
+        [[nodiscard]]
+        auto pixel_transform() const -> const motion::utils::decoding::PixelTransform& {
+            return pixel_transform_;
+        }
+
+        /**
+         * Intrinsics matching the keypoints of this graph, given the full resolution calibration
+         */
+        [[nodiscard]]
+        auto camera(const motion::geometry::PinholeCamera& full_resolution) const -> motion::geometry::PinholeCamera {
+            return pixel_transform_.adjust(full_resolution);
+        }
+
+        /**
+         * Indexes into edges() of every verified pair that contains `image_idx`
+         */
+        [[nodiscard]]
+        auto edges_of(const std::size_t image_idx) const -> const std::vector<std::uint32_t>& {
+            return adjacency_.at(image_idx);
+        }
+    };
+
+    /**
+     * Builds the verified match graph of an unordered image collection: features are extracted once per image,
+     * candidate pairs are pruned, then every pair is matched and verified with a RANSAC fundamental matrix. All
+     * stages run on a work stealing pool. The dataset's get_item must be safe to call concurrently.
+     * With a feature store, build() attaches it to the dataset under this builder's extractor fingerprint, so
+     * later builds (and other users of the dataset) are served from the cache.
+     * @tparam Tag feature backend tag
+     */
+    template<FeatureBackend Tag>
+    class MatchGraphBuilder {
+        using Pipeline = feature_extraction::FeaturePipeline<Tag>;
+        using Matcher = feature_extraction::DescriptorMatcher<Tag>;
+
+        std::shared_ptr<motion::utils::dataloader::Dataset> dataset_;
+        MatchGraphOptions options_;
+        Pipeline pipeline_;
+        std::shared_ptr<motion::utils::feature_store::FeatureStore> feature_store_;
+
+    public:
+        explicit MatchGraphBuilder(std::shared_ptr<motion::utils::dataloader::Dataset> dataset,
+                                   MatchGraphOptions options = {},
+                                   const typename Pipeline::params_type& params = {},
+                                   std::shared_ptr<motion::utils::feature_store::FeatureStore> feature_store = nullptr)
+        :   dataset_(std::move(dataset)),
+            options_(std::move(options)),
+            pipeline_(params),
+            feature_store_(std::move(feature_store)) {
+        }
+
+        [[nodiscard]]
+        auto build() const -> MatchGraph {
+            motion::utils::concurrency::ThreadPool pool(options_.num_threads);
+            const std::size_t num_images = dataset_->size();
+
+            if (feature_store_ != nullptr) {
+                dataset_->attach_feature_store(feature_store_, pipeline_.fingerprint());
+            }
+            std::vector<std::string> image_paths(num_images);
+            std::vector<ImageFeatures> features(num_images);
+            std::atomic<std::size_t> cache_hits {0};
+            const auto& decode_policy = dataset_->decode_policy();
+            const std::uint64_t params_hash = decode_policy.cache_fingerprint(pipeline_.fingerprint());
+            pool.parallel_for(0, num_images, [&](const std::size_t image_idx) {
+                const auto sample = dataset_->get_item(image_idx);
+                image_paths[image_idx] = sample.path;
+                if (sample.features.has_value() and sample.feature_key.has_value() and sample.feature_key->params_hash == params_hash) {
+                    cache_hits.fetch_add(1, std::memory_order_relaxed);
+                }
+                features[image_idx] = pipeline_.extract(sample, feature_store_.get(), decode_policy);
+            }, 1);
+            if (feature_store_ != nullptr) {
+                feature_store_->flush();
+                std::cout << cache_hits.load() << " / " << num_images << " images served from the feature store" << std::endl;
+            }
+
+            const std::vector<ImagePair> pairs = candidate_pairs(features, pool);
+            std::cout << motion::utils::GREEN;
+            std::cout << "Matching " << pairs.size() << " candidate pairs over " << num_images << " images" << std::endl;
+            std::cout << motion::utils::RESET;
+
+            std::vector<std::optional<TwoViewGeometry>> verified(pairs.size());
+            pool.parallel_for(0, pairs.size(), [&](const std::size_t pair_idx) {
+                verified[pair_idx] = match_pair(pairs[pair_idx], features);
+            });
+
+            std::vector<TwoViewGeometry> edges;
+            edges.reserve(std::ranges::count_if(verified, [](const auto& edge) { return edge.has_value(); }));
+            for (auto& edge : verified) {
+                if (edge.has_value()) {
+                    edges.push_back(std::move(*edge));
+                }
+            }
+            std::cout << motion::utils::GREEN;
+            std::cout << edges.size() << " pairs passed geometric verification" << std::endl;
+            std::cout << motion::utils::RESET;
+            return MatchGraph{std::move(image_paths), std::move(features), std::move(edges), dataset_->decode_policy().pixel_transform()};
+        }
+
+        [[nodiscard]]
+        auto candidate_pairs(const std::vector<ImageFeatures>& features, motion::utils::concurrency::ThreadPool& pool) const -> std::vector<ImagePair> {
+            const auto num_images = static_cast<std::uint32_t>(features.size());
+            std::vector<ImagePair> pairs;
+            switch (options_.pair_selection) {
+                case PairSelection::Exhaustive:
+                    pairs.reserve(static_cast<std::size_t>(num_images) * (num_images - 1) / 2);
+                    for (std::uint32_t i = 0; i < num_images; ++i) {
+                        for (std::uint32_t j = i + 1; j < num_images; ++j) {
+                            pairs.push_back({i, j});
+                        }
+                    }
+                    break;
+                case PairSelection::Sequential:
+                    for (std::uint32_t i = 0; i < num_images; ++i) {
+                        const auto last = static_cast<std::uint32_t>(std::min<std::size_t>(num_images, i + 1 + options_.sequential_window));
+                        for (std::uint32_t j = i + 1; j < last; ++j) {
+                            pairs.push_back({i, j});
+                        }
+                    }
+                    break;
+                case PairSelection::Retrieval:
+                    pairs = retrieval_pairs(features, pool);
+                    break;
+            }
+            return pairs;
+        }
+
+    private:
+        [[nodiscard]]
+        auto match_pair(const ImagePair& pair, const std::vector<ImageFeatures>& features) const -> std::optional<TwoViewGeometry> {
+            const ImageFeatures& features_1 = features[pair.image_1];
+            const ImageFeatures& features_2 = features[pair.image_2];
+            const auto matches = Matcher::match(features_1.descriptors, features_2.descriptors, options_.ratio, options_.cross_check);
+            if (matches.size() < std::max<std::size_t>(options_.min_matches, 8)) {
+                return std::nullopt;
+            }
+
+            std::vector<cv::Point2f> points_1, points_2;
+            points_1.reserve(matches.size());
+            points_2.reserve(matches.size());
+            for (const cv::DMatch& match : matches) {
+                points_1.push_back(features_1.keypoints[match.queryIdx].pt);
+                points_2.push_back(features_2.keypoints[match.trainIdx].pt);
+            }
+
+            std::vector<std::uint8_t> inlier_mask;
+            const cv::Mat fundamental = cv::findFundamentalMat(
+                points_1,
+                points_2,
+                cv::FM_RANSAC,
+                options_.ransac_threshold,
+                options_.ransac_confidence,
+                inlier_mask
+            );
+            if (fundamental.rows != 3 or fundamental.cols != 3) {
+                return std::nullopt;
+            }
+
+            TwoViewGeometry geometry {.pair = pair};
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    geometry.fundamental(r, c) = fundamental.at<double>(r, c);
+                }
+            }
+            geometry.inlier_matches.reserve(matches.size());
+            for (std::size_t i = 0; i < matches.size(); ++i) {
+                if (inlier_mask[i] != 0) {
+                    geometry.inlier_matches.push_back({
+                        static_cast<std::uint32_t>(matches[i].queryIdx),
+                        static_cast<std::uint32_t>(matches[i].trainIdx)
+                    });
+                }
+            }
+            if (geometry.inlier_matches.size() < options_.min_inliers) {
+                return std::nullopt;
+            }
+            geometry.inlier_matches.shrink_to_fit();
+            return geometry;
+        }
+
+        /**
+         * Clusters a sample of descriptors into a visual vocabulary. Binary descriptors are clustered on their
+         * unpacked bits and the centres re-binarised, so words share the backend layout and distance.
+         */
+        [[nodiscard]]
+        auto build_vocabulary(const std::vector<ImageFeatures>& features) const -> cv::Mat {
+            using Traits = FeatureTraits<Tag>;
+            constexpr bool is_binary = std::is_same_v<typename Traits::element_type, std::uint8_t>;
+            constexpr int sample_cols = is_binary ? static_cast<int>(Traits::descriptor_size * 8) : static_cast<int>(Traits::descriptor_size);
+
+            std::mt19937 rng(0);
+            cv::Mat samples(0, sample_cols, CV_32F);
+            for (const ImageFeatures& image_features : features) {
+                const int rows = image_features.descriptors.rows;
+                const int take = std::min<int>(rows, static_cast<int>(options_.vocabulary_samples_per_image));
+                std::vector<int> row_indexes(rows);
+                std::iota(row_indexes.begin(), row_indexes.end(), 0);
+                std::ranges::shuffle(row_indexes, rng);
+                for (int k = 0; k < take; ++k) {
+                    cv::Mat sample_row(1, sample_cols, CV_32F);
+                    const int row = row_indexes[k];
+                    if constexpr (is_binary) {
+                        const auto* bytes = image_features.descriptors.ptr<std::uint8_t>(row);
+                        auto* bits = sample_row.ptr<float>(0);
+                        for (int bit = 0; bit < sample_cols; ++bit) {
+                            bits[bit] = static_cast<float>((bytes[bit / 8] >> (bit % 8)) & 1);
+                        }
+                    } else {
+                        image_features.descriptors.row(row).copyTo(sample_row);
+                    }
+                    samples.push_back(sample_row);
+                }
+            }
+
+            const int num_words = std::min<int>(samples.rows, static_cast<int>(options_.vocabulary_size));
+            if (num_words == 0) {
+                return {};
+            }
+            cv::Mat labels, centres;
+            cv::kmeans(
+                samples,
+                num_words,
+                labels,
+                cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 1e-3),
+                1,
+                cv::KMEANS_PP_CENTERS,
+                centres
+            );
+            if constexpr (not is_binary) {
+                return centres;
+            } else {
+                cv::Mat words(num_words, static_cast<int>(Traits::descriptor_size), CV_8UC1, cv::Scalar::all(0));
+                for (int w = 0; w < num_words; ++w) {
+                    const auto* centre = centres.ptr<float>(w);
+                    auto* bytes = words.ptr<std::uint8_t>(w);
+                    for (int bit = 0; bit < sample_cols; ++bit) {
+                        if (centre[bit] > 0.5f) {
+                            bytes[bit / 8] |= static_cast<std::uint8_t>(1u << (bit % 8));
+                        }
+                    }
+                }
+                return words;
+            }
+        }
+
+        /**
+         * Pairs every image with its `retrieval_top_k` nearest neighbours under tf-idf weighted word histograms
+         */
+        [[nodiscard]]
+        auto retrieval_pairs(const std::vector<ImageFeatures>& features, motion::utils::concurrency::ThreadPool& pool) const -> std::vector<ImagePair> {
+            const auto num_images = static_cast<std::uint32_t>(features.size());
+            const cv::Mat vocabulary = build_vocabulary(features);
+            if (vocabulary.empty()) {
+                return {};
+            }
+            const auto num_words = static_cast<Eigen::Index>(vocabulary.rows);
+
+            Eigen::MatrixXf histograms = Eigen::MatrixXf::Zero(num_words, num_images);
+            pool.parallel_for(0, num_images, [&](const std::size_t image_idx) {
+                for (const cv::DMatch& assignment : Matcher::match(features[image_idx].descriptors, vocabulary)) {
+                    histograms(assignment.trainIdx, static_cast<Eigen::Index>(image_idx)) += 1.f;
+                }
+            }, 1);
+
+            const Eigen::VectorXf document_frequency = (histograms.array() > 0.f).cast<float>().rowwise().sum();
+            const Eigen::VectorXf idf = (static_cast<float>(num_images) / (document_frequency.array() + 1.f)).log();
+            histograms = idf.asDiagonal() * histograms;
+            const Eigen::RowVectorXf norms = histograms.colwise().norm().cwiseMax(1e-12f);
+            histograms.array().rowwise() /= norms.array();
+
+            std::vector<std::vector<std::uint32_t>> neighbours(num_images);
+            const std::size_t top_k = std::min<std::size_t>(options_.retrieval_top_k, num_images - 1);
+            pool.parallel_for(0, num_images, [&](const std::size_t image_idx) {
+                const Eigen::VectorXf scores = histograms.transpose() * histograms.col(static_cast<Eigen::Index>(image_idx));
+                std::vector<std::uint32_t> order(num_images);
+                std::iota(order.begin(), order.end(), 0u);
+                std::erase(order, static_cast<std::uint32_t>(image_idx));
+                std::ranges::partial_sort(order, order.begin() + static_cast<std::ptrdiff_t>(top_k),
+                                          [&](const std::uint32_t a, const std::uint32_t b) { return scores(a) > scores(b); });
+                order.resize(top_k);
+                neighbours[image_idx] = std::move(order);
+            });
+
+            std::vector<ImagePair> pairs;
+            pairs.reserve(num_images * top_k);
+            for (std::uint32_t i = 0; i < num_images; ++i) {
+                for (const std::uint32_t j : neighbours[i]) {
+                    pairs.push_back({std::min(i, j), std::max(i, j)});
+                }
+            }
+            std::ranges::sort(pairs);
+            const auto [first, last] = std::ranges::unique(pairs);
+            pairs.erase(first, last);
+            return pairs;
+        }
+    };
+
+    /**
+     * Builds the graph twice through a fresh feature store: the first build fills it, the second must only hit
+     */
+    inline auto test_match_graph(const std::string& sub_dir = "einstein_1_stereo_dataset/rgb2",
+                                 const std::filesystem::path& store_path = std::filesystem::temp_directory_path() / "match_graph.sfmfeat") -> void {
+        std::filesystem::remove(store_path);
+        auto dataset = std::make_shared<motion::utils::dataset::ImagePathDataSet>(
+            motion::utils::dataset::DEFAULT_RESOURCE_DIR,
+            sub_dir,
+            motion::utils::decoding::DecodePolicy::grayscale()
+        );
+        {
+            auto store = std::make_shared<motion::utils::feature_store::FeatureStore>(store_path);
+            const MatchGraphBuilder<feature_extraction::OrbTag> builder(dataset, MatchGraphOptions{.pair_selection = PairSelection::Sequential}, {}, store);
+            for (int run = 0; run < 2; ++run) {
+                const std::size_t cached_before = store->size();
+                const auto start = std::chrono::steady_clock::now();
+                const MatchGraph match_graph = builder.build();
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                std::cout << "run " << run << " : " << match_graph.edges().size() << " verified pairs in " << elapsed.count() << " ms" << std::endl;
+                if (run == 1) {
+                    std::size_t hits {0};
+                    for (std::size_t image_idx = 0; image_idx < dataset->size(); ++image_idx) {
+                        hits += dataset->get_item(image_idx).features.has_value() ? 1 : 0;
+                    }
+                    const bool only_hits = dataset->size() > 0 and hits == dataset->size() and store->size() == cached_before;
+                    std::cout << (only_hits ? motion::utils::GREEN : motion::utils::RED);
+                    std::cout << "second build : " << hits << " / " << dataset->size() << " cache hits, "
+                              << cached_before << " -> " << store->size() << " cached images" << std::endl;
+                    std::cout << motion::utils::RESET;
+                }
+            }
+        }
+        std::filesystem::remove(store_path);
+    }
+}
+
+#endif //MATCH_GRAPH_HPP
@@ -13,6 +13,9 @@
 #include <utility>
 
 #include "sophus/common.hpp"
+#include "feature_backends.hpp"
+#include "../utils/decode_policy.hpp"
+#include "../geometry/geometry_core.hpp"
 
 namespace visual_odometry::feature_extraction {
 
@@ -26,14 +29,14 @@ namespace visual_odometry::feature_extraction {
             cv::Mat image_2;
         };
 
-        inline auto load_images_from_disk() -> TestImages {
+        inline auto load_images_from_disk(const motion::utils::decoding::DecodePolicy& decode_policy = {}) -> TestImages {
             auto path_1 = std::filesystem::path(IMAGE_PATH_1);
             auto path_2 = std::filesystem::path(IMAGE_PATH_2);
             std::cout << (std::filesystem::exists(path_1) ? "true": "false") << std::endl;
             std::cout << (std::filesystem::exists(path_2) ? "true": "false") << std::endl;
             return {
-                .image_1 = cv::imread(IMAGE_PATH_1, cv::IMREAD_COLOR),
-                .image_2 = cv::imread(IMAGE_PATH_2, cv::IMREAD_COLOR)
+                .image_1 = decode_policy.decode(IMAGE_PATH_1),
+                .image_2 = decode_policy.decode(IMAGE_PATH_2)
             };
         }
 
@@ -47,61 +50,69 @@ namespace visual_odometry::feature_extraction {
 
     }
 
-    using OptPtrFeatureExtractor = std::optional<cv::Ptr<cv::FeatureDetector>>;
-
-    struct OrbTag{};
-    struct SiftTag{};
-    struct BriefTag{};
+    using OptPtrFeatureExtractor = std::optional<cv::Ptr<cv::Feature2D>>;
 
     class ExtractorFactory {
-        using OrbPtr = cv::Ptr<cv::ORB>;
-        using SiftPtr = cv::Ptr<cv::SIFT>;
     public:
-        template<typename Tag, typename ... Args>
-        static auto of(Args&&... args) -> OptPtrFeatureExtractor {
-            if constexpr (std::is_same_v<Tag, OrbTag>) {
-                return std::make_unique<std::optional<OrbPtr>>(std::forward<Args>(args)...);
-            } else if constexpr (std::is_same_v<Tag, SiftTag>) {
-                return std::make_unique<std::optional<SiftPtr>>(std::forward<Args>(args)...);
-            } else {
-                static_assert(!std::is_same_v<Tag, OrbTag> or !std::is_same_v<Tag, SiftTag>, "Error unsupported tag used !");
-                return nullptr;
+        template<FeatureBackend Tag>
+        static auto of(const typename FeatureTraits<Tag>::params_type& params = {}) -> OptPtrFeatureExtractor {
+            auto detector = FeatureTraits<Tag>::create_detector(params);
+            if (detector.empty()) {
+                return std::nullopt;
             }
+            return detector;
+        }
+
+        template<FeatureBackend Tag>
+        static auto descriptor_of(const typename FeatureTraits<Tag>::params_type& params = {}) -> OptPtrFeatureExtractor {
+            auto extractor = FeatureTraits<Tag>::create_descriptor_extractor(params);
+            if (extractor.empty()) {
+                return std::nullopt;
+            }
+            return extractor;
         }
     };
 
 
-    class BinaryFeatureExtractor {
+    template<FeatureBackend FeatureTag>
+    class FeatureExtractor {
         cv::Mat image_1_;
         cv::Mat image_2_;
-        std::vector<cv::KeyPoint> keypoints_1_;
-        std::vector<cv::KeyPoint> keypoints_2_;
-        cv::Mat descriptor_1_, descriptor_2_;
-        cv::Ptr<cv::FeatureDetector> detector_ = cv::ORB::create();
-        // cv::Ptr<cv::FeatureDetector> detector_ = ExtractorFactory::of<FeatureTag>().value();
-        cv::Ptr<cv::DescriptorExtractor> descriptor_extractor_ = cv::ORB::create();
-        // cv::Ptr<cv::DescriptorExtractor> descriptor_extractor_ = ExtractorFactory::of<FeatureTag>().value();
-        cv::Ptr<cv::DescriptorMatcher> matcher_ = cv::DescriptorMatcher::create(cv::DescriptorMatcher::BRUTEFORCE_HAMMING);
+        FeaturePipeline<FeatureTag> pipeline_;
+        ImageFeatures features_1_;
+        ImageFeatures features_2_;
 
     public:
-        explicit BinaryFeatureExtractor(cv::Mat  image_1, cv::Mat  image_2): image_1_(std::move(image_1)), image_2_(std::move(image_2)) {};
-
-        auto extract_features() -> BinaryFeatureExtractor& {
-            detector_->detect(image_1_, keypoints_1_);
-            detector_->detect(image_2_, keypoints_2_);
-            
-            descriptor_extractor_->compute(image_1_, keypoints_1_, descriptor_1_);
-            descriptor_extractor_->compute(image_2_, keypoints_2_, descriptor_2_);
+        explicit FeatureExtractor(cv::Mat  image_1, cv::Mat  image_2,
+                                  const typename FeaturePipeline<FeatureTag>::params_type& params = {})
+        : image_1_(std::move(image_1)), image_2_(std::move(image_2)), pipeline_(params) {};
+
+        auto extract_features() -> FeatureExtractor& {
+            features_1_ = pipeline_.extract(image_1_);
+            features_2_ = pipeline_.extract(image_2_);
+            return *this;
+        }
+
+        /**
+         * Same as extract_features() but served from / recorded into a persistent feature store, keyed on the
+         * content of the image files the pair was loaded from
+         */
+        auto extract_features(feature_store::FeatureStore& store, const std::filesystem::path& path_1, const std::filesystem::path& path_2,
+                              const motion::utils::decoding::DecodePolicy& decode_policy = {}) -> FeatureExtractor& {
+            features_1_ = pipeline_.extract(path_1, store, decode_policy);
+            features_2_ = pipeline_.extract(path_2, store, decode_policy);
             return *this;
         }
 
 
         [[nodiscard]]
         auto match_features(const float& threshold = 30 ) const -> std::vector<cv::DMatch> {
-            assert(!descriptor_1_.empty() or descriptor_2_.empty());
-            std::vector<cv::DMatch> matches_;
-            matcher_->match(descriptor_1_, descriptor_2_, matches_);
-            const auto [min_elem, max_elem ] = std::ranges::minmax(matches_, [](const cv::DMatch& a, cv::DMatch& b) {return a.distance < b.distance;});
+            assert(!features_1_.descriptors.empty() and !features_2_.descriptors.empty());
+            const std::vector<cv::DMatch> matches_ = pipeline_.match(features_1_, features_2_);
+            if (matches_.empty()) {
+                return matches_;
+            }
+            const auto min_elem = std::ranges::min(matches_, {}, &cv::DMatch::distance);
             return std::ranges::to<std::vector<cv::DMatch>>(
                     matches_
                     |std::views::filter(
@@ -113,18 +124,18 @@ namespace visual_odometry::feature_extraction {
         }
 
         auto get_keypoints_1() const -> std::vector<cv::KeyPoint> {
-            return keypoints_1_;
+            return features_1_.keypoints;
         }
 
 
         auto get_keypoints_2() const -> std::vector<cv::KeyPoint> {
-            return keypoints_2_;
+            return features_2_.keypoints;
         }
 
         auto display_extracted_features() const -> void {
             cv::Mat output_image_1, output_image_2;
-            cv::drawKeypoints(image_1_, keypoints_1_, output_image_1, cv::Scalar::all(-1), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
-            cv::drawKeypoints(image_2_, keypoints_1_, output_image_2, cv::Scalar::all(-1), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
+            cv::drawKeypoints(image_1_, features_1_.keypoints, output_image_1, cv::Scalar::all(-1), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
+            cv::drawKeypoints(image_2_, features_2_.keypoints, output_image_2, cv::Scalar::all(-1), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
             cv::Mat display_image;
             cv::hconcat(output_image_1, output_image_2, display_image);
             cv::imshow("Extracted_features", display_image);
@@ -136,7 +147,7 @@ namespace visual_odometry::feature_extraction {
         auto display_match_results(const float& threshold = 30) const -> void {
             auto good_matches = match_features(threshold);
             cv::Mat display_image;
-            cv::drawMatches(image_1_, keypoints_1_, image_2_, keypoints_2_, good_matches, display_image);
+            cv::drawMatches(image_1_, features_1_.keypoints, image_2_, features_2_.keypoints, good_matches, display_image);
             cv::imshow("Matches", display_image);
             cv::waitKey(0);
             cv::destroyAllWindows();
@@ -145,26 +156,47 @@ namespace visual_odometry::feature_extraction {
 
     };
 
+    using BinaryFeatureExtractor = FeatureExtractor<OrbTag>;
+    using FloatFeatureExtractor = FeatureExtractor<SiftTag>;
+
     namespace TUM_DATASET_DEFAULTS {
-        const cv::Mat CAMERA_INTRINSICS { (cv::Mat_<double>(3, 3) <<  520.9, 0, 325.1, 0, 521.0, 249.7, 0, 0, 1) };
-        const cv::Point2d PRINCIPLE_POINT {325.1, 249.7 };
-        constexpr double FOCAL_LENGTH { 521.0 };
+        constexpr motion::geometry::PinholeCamera CAMERA_INTRINSICS { motion::geometry::cameras::TUM_FREIBURG_1 };
+        const cv::Point2d PRINCIPLE_POINT { CAMERA_INTRINSICS.principal_point() };
+        constexpr double FOCAL_LENGTH { CAMERA_INTRINSICS.fy };
     }
 
     class PoseEstimator {
         std::vector<cv::KeyPoint> keypoints_1_;
         std::vector<cv::KeyPoint> keypoints_2_;
         std::vector<cv::DMatch> matches_;
+        motion::geometry::PinholeCamera camera_;
     public:
+        /**
+         * Relative pose mapping frame 1 coordinates into frame 2, stack allocated
+         */
         struct PoseEstimations {
-            cv::Mat R;
-            cv::Mat t;
+            Sophus::SE3d pose;
+
+            [[nodiscard]]
+            auto R() const -> Eigen::Matrix3d {
+                return pose.rotationMatrix();
+            }
+
+            [[nodiscard]]
+            auto t() const -> const Eigen::Vector3d& {
+                return pose.translation();
+            }
         };
+        /**
+         * @param camera intrinsics of the images the keypoints were extracted from; for reduced or cropped decodes
+         * pass DecodePolicy::adjust() of the full resolution calibration
+         */
         explicit PoseEstimator(
             const std::vector<cv::KeyPoint>& key_points_1,
             const std::vector<cv::KeyPoint>& key_points_2,
-            const std::vector<cv::DMatch>& matches)
-            : keypoints_1_(key_points_1), keypoints_2_(key_points_2), matches_(matches) {
+            const std::vector<cv::DMatch>& matches,
+            const motion::geometry::PinholeCamera& camera = TUM_DATASET_DEFAULTS::CAMERA_INTRINSICS)
+            : keypoints_1_(key_points_1), keypoints_2_(key_points_2), matches_(matches), camera_(camera) {
 
         }
 
@@ -187,11 +219,11 @@ namespace visual_odometry::feature_extraction {
             }
 
             cv::Mat fundamental_mat = cv::findFundamentalMat(points_1, points_2, cv::FM_8POINT);
+            const cv::Matx33d camera_matrix = camera_.to_cv();
             cv::Mat essential_mat = cv::findEssentialMat(
                 points_1,
                 points_2,
-                TUM_DATASET_DEFAULTS::FOCAL_LENGTH,
-                TUM_DATASET_DEFAULTS::PRINCIPLE_POINT
+                camera_matrix
             );
 
             cv::Mat homography_mat = cv::findHomography(
@@ -201,20 +233,20 @@ namespace visual_odometry::feature_extraction {
                 3
             );
 
-            cv::Mat R, t;
+            // Fixed size outputs: OpenCV writes straight into the stack buffers
+            cv::Matx33d R;
+            cv::Vec3d t;
             cv::recoverPose(
                 essential_mat,
                 points_1,
                 points_2,
-                R, t,
-                TUM_DATASET_DEFAULTS::FOCAL_LENGTH,
-                TUM_DATASET_DEFAULTS::PRINCIPLE_POINT
+                camera_matrix,
+                R, t
             );
 
             std::cout << "Completed pose estimation " << std::endl;
             return PoseEstimations{
-                .R = R,
-                .t = t,
+                .pose = motion::geometry::cv_adapters::to_sophus(R, t)
             };
         }
 
@@ -223,7 +255,9 @@ namespace visual_odometry::feature_extraction {
     };
 
     inline auto test_binary_feature_extractor() -> void {
-        const auto [image_1, image_2] = temporary_data_access::load_images_from_disk();
+        // ORB only looks at intensity, so skip the colour decode entirely
+        const auto decode_policy = motion::utils::decoding::DecodePolicy::grayscale();
+        const auto [image_1, image_2] = temporary_data_access::load_images_from_disk(decode_policy);
         auto binary_extractor = BinaryFeatureExtractor(image_1, image_2);
         auto matches = binary_extractor
             .extract_features()
@@ -232,13 +266,115 @@ namespace visual_odometry::feature_extraction {
         PoseEstimator pose_estimator = PoseEstimator(
             binary_extractor.get_keypoints_1(),
             binary_extractor.get_keypoints_2(),
-            matches
+            matches,
+            decode_policy.adjust(TUM_DATASET_DEFAULTS::CAMERA_INTRINSICS)
         );
         auto pose_estimation = pose_estimator.perform_pose_estimation();
-        std::cout <<"R matrix " << pose_estimation.R << std::endl;
-        std::cout <<"t matrix " << pose_estimation.t << std::endl;
+        std::cout <<"R matrix " << pose_estimation.R() << std::endl;
+        std::cout <<"t matrix " << pose_estimation.t().transpose() << std::endl;
     }
 
+    inline auto test_feature_backends() -> void {
+        const auto test_images = temporary_data_access::load_images_from_disk();
+        const auto report = [&]<FeatureBackend Tag>(Tag) {
+            const FeaturePipeline<Tag> pipeline{};
+            const auto features_1 = pipeline.extract(test_images.image_1);
+            const auto features_2 = pipeline.extract(test_images.image_2);
+            const auto matches = pipeline.match(features_1, features_2, 0.8f);
+            std::cout << FeatureTraits<Tag>::name << " : " << matches.size() << " ratio test matches" << std::endl;
+        };
+        report(OrbTag{});
+        report(SiftTag{});
+    }
+
+    /**
+     * Times DescriptorMatcher against the cv::BFMatcher path it replaced on the test pair, same ratio test on both
+     */
+    inline auto test_matcher_benchmark(const int repetitions = 20) -> void {
+        const auto test_images = temporary_data_access::load_images_from_disk();
+        const auto time_us = [repetitions](auto&& run) {
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repetitions; ++i) {
+                run();
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / repetitions;
+        };
+        const auto report = [&]<FeatureBackend Tag>(Tag) {
+            constexpr float max_ratio {0.8f};
+            const FeaturePipeline<Tag> pipeline{};
+            const auto features_1 = pipeline.extract(test_images.image_1);
+            const auto features_2 = pipeline.extract(test_images.image_2);
+            const int norm = std::is_floating_point_v<typename FeatureTraits<Tag>::element_type> ? cv::NORM_L2 : cv::NORM_HAMMING;
+            const auto bf_matcher = cv::BFMatcher::create(norm);
+
+            std::size_t bf_matches {0};
+            const auto bf_us = time_us([&] {
+                std::vector<std::vector<cv::DMatch>> knn_matches;
+                bf_matcher->knnMatch(features_1.descriptors, features_2.descriptors, knn_matches, 2);
+                bf_matches = std::ranges::count_if(knn_matches, [](const std::vector<cv::DMatch>& pair) {
+                    return pair.size() == 2 and pair[0].distance < max_ratio * pair[1].distance;
+                });
+            });
+            std::size_t kernel_matches {0};
+            const auto kernel_us = time_us([&] {
+                kernel_matches = DescriptorMatcher<Tag>::match(features_1.descriptors, features_2.descriptors, max_ratio).size();
+            });
+            std::cout << (kernel_us <= bf_us ? motion::utils::GREEN : motion::utils::RED);
+            std::cout << FeatureTraits<Tag>::name << " (" << features_1.descriptors.rows << " x " << features_2.descriptors.rows << ") : "
+                      << "BFMatcher " << bf_us << " us / " << bf_matches << " matches, "
+                      << "DescriptorMatcher " << kernel_us << " us / " << kernel_matches << " matches" << std::endl;
+            std::cout << motion::utils::RESET;
+        };
+        report(OrbTag{});
+        report(SiftTag{});
+    }
+
+    /**
+     * Extracts the test pair twice, the second time through a store reopened from disk: it must be served entirely
+     * from the cache and return exactly the first run's features
+     */
+    inline auto test_feature_store(const std::filesystem::path& store_path = std::filesystem::temp_directory_path() / "features.sfmfeat") -> void {
+        std::filesystem::remove(store_path);
+        const FeaturePipeline<OrbTag> pipeline{};
+        const std::array<std::filesystem::path, 2> image_paths {temporary_data_access::IMAGE_PATH_1, temporary_data_access::IMAGE_PATH_2};
+        const auto same_features = [](const ImageFeatures& lhs, const ImageFeatures& rhs) {
+            const bool same_keypoints = std::ranges::equal(lhs.keypoints, rhs.keypoints, [](const cv::KeyPoint& a, const cv::KeyPoint& b) {
+                return a.pt == b.pt and a.size == b.size and a.angle == b.angle and a.response == b.response
+                    and a.octave == b.octave and a.class_id == b.class_id;
+            });
+            const bool same_descriptors = lhs.descriptors.size() == rhs.descriptors.size()
+                and lhs.descriptors.type() == rhs.descriptors.type()
+                and (lhs.descriptors.empty() or cv::norm(lhs.descriptors, rhs.descriptors, cv::NORM_INF) == 0);
+            return same_keypoints and same_descriptors;
+        };
+
+        std::array<ImageFeatures, 2> first_run;
+        bool passed {true};
+        for (int run = 0; run < 2; ++run) {
+            feature_store::FeatureStore store(store_path);
+            const std::size_t cached_before = store.size();
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < image_paths.size(); ++i) {
+                auto features = pipeline.extract(image_paths[i], store);
+                if (run == 0) {
+                    first_run[i] = std::move(features);
+                } else if (not same_features(first_run[i], features)) {
+                    std::cout << motion::utils::RED << "run 1 : cached features of " << image_paths[i] << " differ" << motion::utils::RESET << std::endl;
+                    passed = false;
+                }
+            }
+            store.flush();
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "run " << run << " : " << elapsed.count() << " us, " << cached_before << " -> " << store.size() << " cached images" << std::endl;
+            if (run == 1 and (cached_before != image_paths.size() or store.size() != cached_before)) {
+                std::cout << motion::utils::RED << "run 1 : expected only cache hits" << motion::utils::RESET << std::endl;
+                passed = false;
+            }
+        }
+        std::filesystem::remove(store_path);
+        std::cout << (passed ? motion::utils::GREEN + "feature store round trip ok" : motion::utils::RED + "feature store round trip FAILED")
+                  << motion::utils::RESET << std::endl;
+    }
 
 }
 #endif //VISUAL_ODOMETRY_INTRO_HPP
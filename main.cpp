@@ -4,7 +4,11 @@
 #include "include/testing_out_stuff/ceres_playgroung.hpp"
 #include "include/utils/trajectory_utils.hpp"
 #include "include/utils/data_loader.hpp"
+#include "include/utils/thread_pool.hpp"
+#include "include/utils/trajectory_storage.hpp"
 #include "include/visual_odometry/visual_odometry_intro.hpp"
+#include "include/visual_odometry/match_graph.hpp"
+#include "include/visual_odometry/incremental_sfm.hpp"
 
 namespace functional {
     auto parse_urls(std::string url) -> std::optional<std::vector<std::string>>;
@@ -26,6 +30,11 @@ int main() {
     // motion::utils::draw_trajectories_open_gl_context();
     // motion::tests::hello_world_ceres();
     // motion::utils::test_dataloader::test_getting_batches(200);
+    // motion::utils::test_dataloader::test_sharded_batches();
+    // motion::geometry::test_geometry_core();
+    // visual_odometry::matching::test_match_graph();
+    // visual_odometry::reconstruction::test_incremental_sfm();
+    // motion::utils::trajectory_storage::test_trajectory_storage();
     visual_odometry::feature_extraction::test_binary_feature_extractor();
     return 0;
 }
\ No newline at end of file